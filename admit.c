@@ -0,0 +1,166 @@
+/**
+ * admit.c
+ * Admission queue for programs that did not fit in memory when loaded.
+ *
+ * Pending jobs are kept in arrival order under a min-segment-tree of their
+ * sizes. The SMM free hook only compares the hole it just produced with the
+ * tree root (the smallest pending job), so frees that cannot help anyone
+ * cost O(1); when one can, admission_poll() picks jobs in O(log n) each:
+ * the leftmost job that fits (FIFO) or the smallest one (ADMIT_SMALLEST).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "admit.h"
+#include "disk.h"
+#include "smm.h"
+#include "scheduler.h"
+
+int admission_policy = ADMIT_FIFO;
+
+struct job {
+    char *fname;
+    int size;
+    int enqueued; /* cycle the job was queued at */
+};
+
+static struct job *jobs = NULL;
+static int njobs = 0;     /* slots used, in arrival order */
+static int cap = 0;       /* leaves in the tree, a power of two */
+static int *tree = NULL;  /* tree[1] is the root, leaves at cap..2*cap-1 */
+static int pending = 0;
+
+static int wake = 0;      /* set by the free hook when a pending job may fit */
+
+static long queued_total = 0;
+static long admitted_total = 0;
+static long rejected_total = 0; /* could not be loaded once admitted */
+static long delay_total = 0;
+static int delay_max = 0;
+
+static void tree_set(int slot, int value)
+{
+    int i = cap + slot;
+    tree[i] = value;
+    for (i /= 2; i >= 1; i /= 2) {
+        tree[i] = tree[2 * i] < tree[2 * i + 1] ? tree[2 * i] : tree[2 * i + 1];
+    }
+}
+
+/* leftmost slot whose size is <= limit, or -1 */
+static int tree_first_fit(int limit)
+{
+    if (pending == 0 || tree[1] > limit) return -1;
+    int i = 1;
+    while (i < cap) i = tree[2 * i] <= limit ? 2 * i : 2 * i + 1;
+    return i - cap;
+}
+
+/* leftmost slot holding the smallest size, or -1 */
+static int tree_smallest(void)
+{
+    if (pending == 0) return -1;
+    int i = 1;
+    while (i < cap) i = tree[2 * i] == tree[i] ? 2 * i : 2 * i + 1;
+    return i - cap;
+}
+
+static void admission_on_free(int hole_size)
+{
+    if (pending > 0 && tree[1] <= hole_size) wake = 1;
+}
+
+static int admission_grow(void)
+{
+    /* all earlier jobs are gone: start over at slot 0 */
+    if (pending == 0) njobs = 0;
+    if (njobs < cap) return 1;
+
+    int ncap = cap ? cap * 2 : 64;
+    struct job *nj = (struct job *)realloc(jobs, ncap * sizeof(struct job));
+    if (!nj) return 0;
+    jobs = nj;
+    int *nt = (int *)malloc(2 * ncap * sizeof(int));
+    if (!nt) return 0;
+    for (int i = 0; i < 2 * ncap; ++i) nt[i] = INT_MAX;
+    free(tree);
+    tree = nt;
+    cap = ncap;
+    for (int s = 0; s < njobs; ++s) {
+        if (jobs[s].fname) tree_set(s, jobs[s].size);
+    }
+    return 1;
+}
+
+/**
+ * queue a program that could not be allocated; it is admitted by
+ * admission_poll() once a hole of `size` words shows up
+ */
+void admission_enqueue(char *fname, int size, int cycle_num)
+{
+    if (!tree) smm_set_free_hook(admission_on_free);
+    if (!admission_grow()) {
+        fprintf(stderr, "admission_enqueue: out of memory, dropping '%s'\n", fname);
+        return;
+    }
+    char *copy = strdup(fname);
+    if (!copy) {
+        fprintf(stderr, "admission_enqueue: out of memory, dropping '%s'\n", fname);
+        return;
+    }
+
+    int slot = njobs++;
+    jobs[slot].fname = copy;
+    jobs[slot].size = size;
+    jobs[slot].enqueued = cycle_num;
+    tree_set(slot, size);
+    pending++;
+    queued_total++;
+}
+
+/**
+ * admit pending jobs if the free hook saw a large enough hole, or if
+ * nothing is running (memory will not change by itself then).
+ * returns the number of jobs admitted
+ */
+int admission_poll(int cycle_num)
+{
+    if (pending == 0) return 0;
+    if (!wake && !ready_queue_empty()) return 0;
+    wake = 0;
+
+    int admitted = 0;
+    while (pending > 0) {
+        int slot = admission_policy == ADMIT_SMALLEST ? tree_smallest() : tree_first_fit(largest_hole());
+        if (slot < 0 || jobs[slot].size > largest_hole()) break;
+
+        struct job *j = &jobs[slot];
+        int rc = admit_program(j->fname, j->size, cycle_num);
+        if (rc == 0) break; /* no room after all; keep it queued */
+        if (rc < 0) {
+            fprintf(stderr, "admission_poll: '%s' could not be loaded - dropping it\n", j->fname);
+            rejected_total++;
+        } else {
+            int delay = cycle_num - j->enqueued;
+            delay_total += delay;
+            if (delay > delay_max) delay_max = delay;
+            admitted_total++;
+            admitted++;
+        }
+
+        free(j->fname);
+        j->fname = NULL;
+        tree_set(slot, INT_MAX);
+        pending--;
+    }
+    return admitted;
+}
+
+void print_admission_stats(void)
+{
+    printf("Admission: %ld queued, %ld admitted later (avg delay %.1f, max %d cycles), %ld rejected, %d never admitted\n",
+           queued_total, admitted_total,
+           admitted_total ? (double)delay_total / admitted_total : 0.0, delay_max, rejected_total, pending);
+}
@@ -0,0 +1,17 @@
+/**
+ * admit.h
+ * Admission queue for programs that did not fit in memory when loaded.
+ */
+#ifndef ADMIT_H
+#define ADMIT_H
+
+#define ADMIT_FIFO     0 /* earliest queued job that fits */
+#define ADMIT_SMALLEST 1 /* smallest queued job first */
+
+extern int admission_policy;
+
+void admission_enqueue(char *fname, int size, int cycle_num);
+int admission_poll(int cycle_num);
+void print_admission_stats(void);
+
+#endif
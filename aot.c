@@ -0,0 +1,400 @@
+/**
+ * aot.c
+ * Ahead-of-time compilation of guest programs to native code.
+ *
+ * aot_attach() translates a program's text into C, one function per basic
+ * block, builds it with aot_cc into a shared object and dlopen()s it. The
+ * object is kept in aot_cache_dir under the hash of the text, so a program
+ * is compiled once and later runs (and processes running the same text)
+ * reuse it. At run time aot_run() executes the running process natively
+ * on a copy of AC/MAR/MBR/SP, at most as many instructions as are left in
+ * the quantum, with every data access going through the CPU's own
+ * cpu_data_read()/cpu_data_write(). The generated code yields when the
+ * quantum ends, at exit, after an access that faulted or wrote into the
+ * text (that process then stays on the interpreter), when a branch leaves
+ * the text and before spawn or an invalid opcode; the CPU registers, IR0/
+ * IR1 and the cycle count come out exactly as clock_cycle() would have left
+ * them, so the scheduler cannot tell the difference. The fetch hooks of
+ * timing, the heatmap, the line profiler and demand loading are not
+ * modelled: while any of them is active the interpreter runs everything.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "aot.h"
+#include "cpu.h"
+#include "scheduler.h"
+#include "table.h"
+#include "timing.h"
+#include "heatmap.h"
+#include "lineprof.h"
+#include "demand.h"
+
+#define AOT_ABI 1 /* bump when struct aot_cpu or the generated code changes */
+
+int aot_enabled = 0;              /* set to 1 to run programs as compiled native code */
+int aot_active = 0;               /* processes that currently have compiled code */
+char aot_cache_dir[] = "aot_cache";
+char aot_cc[] = "cc";             /* compiler used for the generated C */
+
+/* why the generated code returned */
+enum { AOT_RUNNING, AOT_STOPPED, AOT_QUANTUM, AOT_EXIT, AOT_LEAVE };
+
+/* shared with the generated code; the layout is part of AOT_ABI */
+struct aot_cpu {
+    int ac, mar, mbr, sp;
+    int last;     /* text index of the last instruction run, -1 if none */
+    int stop;     /* AOT_RUNNING until the code yields */
+    long budget;  /* instructions left in the quantum */
+    int (*read)(struct aot_cpu *c, int l_addr);
+    void (*write)(struct aot_cpu *c, int l_addr, int value);
+};
+
+struct aot_module {
+    unsigned long long hash;
+    void *handle;
+    int (*entry)(struct aot_cpu *c, int pc); /* runs from pc, returns the pc to resume at */
+    const int (*text)[2];                    /* the text it was compiled from */
+    int count;
+    struct aot_module *next;
+};
+
+static struct aot_module *modules = NULL;    /* every object loaded so far */
+static struct aot_module **attached = NULL;  /* by PID */
+static int attached_cap = 0;
+
+static int running_pid = -1;
+
+static int compiled = 0, cache_hits = 0, shared = 0, failed = 0, text_writes = 0;
+static long runs = 0, native_instructions = 0;
+static long stops[AOT_LEAVE + 1];
+
+static const char *op_names[] = {
+    "exit", "load_const", "move_from_mbr", "move_from_mar", "move_to_mbr", "move_to_mar",
+    "load_at_addr", "write_at_addr", "add", "multiply", "and", "or", "ifgo", "sleep",
+    "spawn", "add_imm", "dbnz", "load_from", "store_to", "load_idx", "store_idx",
+    "push", "pop", "call", "ret"
+};
+#define NOPS ((int)(sizeof(op_names) / sizeof(op_names[0])))
+
+static unsigned long long text_hash(int (*text)[2], int count)
+{
+    unsigned long long h = 1469598103934665603ULL; /* FNV-1a */
+    int head[2] = { AOT_ABI, count };
+    const unsigned char *p = (const unsigned char *)head;
+    for (size_t i = 0; i < sizeof(head); ++i) h = (h ^ p[i]) * 1099511628211ULL;
+    p = (const unsigned char *)text;
+    for (size_t i = 0; i < count * sizeof(text[0]); ++i) h = (h ^ p[i]) * 1099511628211ULL;
+    return h;
+}
+
+/* an int as a C literal; INT_MIN has none */
+static void emit_int(FILE *f, int v)
+{
+    if (v == INT_MIN) fprintf(f, "(-%d - 1)", INT_MAX);
+    else fprintf(f, "(%d)", v);
+}
+
+/* ends a basic block: control continues somewhere computed, or the code yields */
+static int is_terminator(int op)
+{
+    return op == 0 || op == 12 || op == 14 || op == 16 || op == 23 || op == 24 || op < 0 || op >= NOPS;
+}
+
+/* the statement(s) for instruction i, after its case label */
+static void emit_instruction(FILE *f, int (*text)[2], int i)
+{
+    int op = text[i][0], arg = text[i][1];
+    if (op == 14 || op < 0 || op >= NOPS) {
+        /* spawn creates a process from the CPU registers; the interpreter reports bad opcodes */
+        fprintf(f, "c->stop = AOT_LEAVE; return %d;\n", i);
+        return;
+    }
+    fprintf(f, "STEP(%d) ", i);
+    switch (op) {
+        case 0: fprintf(f, "c->stop = AOT_EXIT; return %d;", i); break;
+        case 1: fprintf(f, "c->ac = "); emit_int(f, arg); fprintf(f, ";"); break;
+        case 2: fprintf(f, "c->ac = c->mbr;"); break;
+        case 3: fprintf(f, "c->ac = c->mar;"); break;
+        case 4: fprintf(f, "c->mbr = c->ac;"); break;
+        case 5: fprintf(f, "c->mar = c->ac;"); break;
+        case 6: fprintf(f, "c->mbr = c->read(c, c->mar); CHECK(%d)", i + 1); break;
+        case 7: fprintf(f, "c->write(c, c->mar, c->mbr); CHECK(%d)", i + 1); break;
+        case 8: fprintf(f, "c->ac += c->mbr;"); break;
+        case 9: fprintf(f, "c->ac *= c->mbr;"); break;
+        case 10: fprintf(f, "c->ac = c->ac != 0 && c->mbr != 0;"); break;
+        case 11: fprintf(f, "c->ac = c->ac != 0 || c->mbr != 0;"); break;
+        case 12: fprintf(f, "if (c->ac != 0) return "); emit_int(f, arg); fprintf(f, "; return %d;", i + 1); break;
+        case 13: break;
+        case 15: fprintf(f, "c->ac += "); emit_int(f, arg); fprintf(f, ";"); break;
+        case 16: fprintf(f, "if (--c->ac != 0) return "); emit_int(f, arg); fprintf(f, "; return %d;", i + 1); break;
+        case 17: fprintf(f, "c->ac = c->read(c, "); emit_int(f, arg); fprintf(f, "); CHECK(%d)", i + 1); break;
+        case 18: fprintf(f, "c->write(c, "); emit_int(f, arg); fprintf(f, ", c->ac); CHECK(%d)", i + 1); break;
+        case 19: fprintf(f, "c->ac = c->read(c, c->mar + "); emit_int(f, arg); fprintf(f, "); CHECK(%d)", i + 1); break;
+        case 20: fprintf(f, "c->write(c, c->mar + "); emit_int(f, arg); fprintf(f, ", c->ac); CHECK(%d)", i + 1); break;
+        case 21: fprintf(f, "c->sp--; c->write(c, c->sp, c->ac); CHECK(%d)", i + 1); break;
+        case 22: fprintf(f, "c->ac = c->read(c, c->sp); c->sp++; CHECK(%d)", i + 1); break;
+        case 23: fprintf(f, "c->sp--; c->write(c, c->sp, %d); return ", i + 1); emit_int(f, arg); fprintf(f, ";"); break;
+        case 24: fprintf(f, "{ int t = c->read(c, c->sp); c->sp++; return t; }"); break;
+    }
+    fprintf(f, " /* %s %d */\n", op_names[op], arg);
+}
+
+/**
+ * write the C for a program: a function per basic block, entered at any
+ * of its instructions through a switch, and aot_entry() dispatching
+ * between blocks until the code yields
+ */
+static int generate(const char *path, unsigned long long hash, int (*text)[2], int count)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+
+    char *leader = calloc(count + 1, 1);
+    if (!leader) {
+        fclose(f);
+        return 0;
+    }
+    leader[0] = 1;
+    for (int i = 0; i < count; ++i) {
+        int op = text[i][0], arg = text[i][1];
+        if ((op == 12 || op == 16 || op == 23) && arg >= 0 && arg < count) leader[arg] = 1;
+        if (is_terminator(op)) leader[i + 1] = 1;
+    }
+
+    fprintf(f, "/* generated from guest program %016llx; do not edit */\n", hash);
+    fprintf(f, "struct aot_cpu {\n    int ac, mar, mbr, sp;\n    int last;\n    int stop;\n    long budget;\n"
+               "    int (*read)(struct aot_cpu *c, int l_addr);\n"
+               "    void (*write)(struct aot_cpu *c, int l_addr, int value);\n};\n\n");
+    fprintf(f, "#define AOT_QUANTUM %d\n#define AOT_EXIT %d\n#define AOT_LEAVE %d\n", AOT_QUANTUM, AOT_EXIT, AOT_LEAVE);
+    fprintf(f, "#define STEP(i) if (c->budget == 0) { c->stop = AOT_QUANTUM; return i; } c->budget--; c->last = i;\n");
+    fprintf(f, "#define CHECK(next) if (c->stop) return next;\n\n");
+
+    for (int first = 0; first < count; ) {
+        int end = first + 1;
+        while (end < count && !leader[end]) end++;
+        fprintf(f, "static int b%d(struct aot_cpu *c, int pc)\n{\n    switch (pc) {\n", first);
+        for (int i = first; i < end; ++i) {
+            fprintf(f, "    case %d: ", i);
+            emit_instruction(f, text, i);
+        }
+        fprintf(f, "    }\n    return %d;\n}\n\n", end);
+        first = end;
+    }
+
+    fprintf(f, "int aot_entry(struct aot_cpu *c, int pc)\n{\n    while (!c->stop) {\n        switch (pc) {\n");
+    for (int first = 0; first < count; ) {
+        int end = first + 1;
+        while (end < count && !leader[end]) end++;
+        fprintf(f, "       ");
+        for (int i = first; i < end; ++i) fprintf(f, " case %d:", i);
+        fprintf(f, " pc = b%d(c, pc); break;\n", first);
+        first = end;
+    }
+    fprintf(f, "        default: c->stop = AOT_LEAVE; break;\n        }\n    }\n    return pc;\n}\n\n");
+
+    fprintf(f, "const int aot_abi = %d;\nconst int aot_count = %d;\nconst int aot_text[%d][2] = {\n", AOT_ABI, count, count);
+    for (int i = 0; i < count; ++i) {
+        fprintf(f, "    { %d, ", text[i][0]);
+        emit_int(f, text[i][1]);
+        fprintf(f, " },\n");
+    }
+    fprintf(f, "};\n");
+    free(leader);
+    return fclose(f) == 0;
+}
+
+/* build src into so with aot_cc; so appears atomically */
+static int compile(const char *src, const char *so)
+{
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", so, (int)getpid());
+    pid_t pid = fork();
+    if (pid == 0) {
+        execlp(aot_cc, aot_cc, "-O2", "-fwrapv", "-fPIC", "-shared", "-o", tmp, src, (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0) return 0;
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "aot: %s failed on %s\n", aot_cc, src);
+        unlink(tmp);
+        return 0;
+    }
+    if (rename(tmp, so) < 0) {
+        unlink(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+/* dlopen so and check that it was compiled from text; NULL if not */
+static struct aot_module *open_module(const char *so, unsigned long long hash, int (*text)[2], int count)
+{
+    void *handle = dlopen(so, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) return NULL;
+    const int *abi = dlsym(handle, "aot_abi");
+    const int *n = dlsym(handle, "aot_count");
+    const int (*t)[2] = dlsym(handle, "aot_text");
+    void *entry = dlsym(handle, "aot_entry");
+    struct aot_module *m = NULL;
+    if (abi && n && t && entry && *abi == AOT_ABI && *n == count && memcmp(t, text, count * sizeof(text[0])) == 0) {
+        m = malloc(sizeof(*m));
+    }
+    if (!m) {
+        dlclose(handle);
+        return NULL;
+    }
+    m->hash = hash;
+    m->handle = handle;
+    *(void **)&m->entry = entry;
+    m->text = t;
+    m->count = count;
+    m->next = modules;
+    modules = m;
+    return m;
+}
+
+/* the compiled code for text: already loaded, from the cache, or built now */
+static struct aot_module *module_for(int (*text)[2], int count)
+{
+    unsigned long long hash = text_hash(text, count);
+    for (struct aot_module *m = modules; m; m = m->next) {
+        if (m->hash == hash && m->count == count && memcmp(m->text, text, count * sizeof(text[0])) == 0) {
+            shared++;
+            return m;
+        }
+    }
+
+    char so[PATH_MAX], src[PATH_MAX], tmp_src[PATH_MAX];
+    snprintf(so, sizeof(so), "%s/%016llx.so", aot_cache_dir, hash);
+    snprintf(src, sizeof(src), "%s/%016llx.c", aot_cache_dir, hash);
+    snprintf(tmp_src, sizeof(tmp_src), "%s/%016llx.%d.c", aot_cache_dir, hash, (int)getpid());
+
+    struct aot_module *m = open_module(so, hash, text, count);
+    if (m) {
+        cache_hits++;
+        return m;
+    }
+
+    /* missing, or left by another build: compile afresh */
+    mkdir(aot_cache_dir, 0777);
+    if (!generate(tmp_src, hash, text, count) || !compile(tmp_src, so)) {
+        unlink(tmp_src);
+        failed++;
+        return NULL;
+    }
+    rename(tmp_src, src); /* kept next to the object for reading */
+    m = open_module(so, hash, text, count);
+    if (m) compiled++;
+    else failed++;
+    return m;
+}
+
+static void detach(int pid)
+{
+    if (pid < 0 || pid >= attached_cap || !attached[pid]) return;
+    attached[pid] = NULL;
+    aot_active--;
+}
+
+static void attach(int pid, struct aot_module *m)
+{
+    if (!table_reserve((void **)&attached, &attached_cap, pid, sizeof(*attached))) return;
+    if (!attached[pid]) aot_active++;
+    attached[pid] = m;
+}
+
+/* run pid's `count` instructions of text as compiled code from now on */
+void aot_attach(int pid, int (*text)[2], int count)
+{
+    if (!aot_enabled || pid < 0 || !text || count <= 0) return;
+    struct aot_module *m = module_for(text, count);
+    if (m) attach(pid, m);
+}
+
+/* a spawned child runs its parent's text */
+void aot_fork(int parent, int child)
+{
+    if (parent >= 0 && parent < attached_cap && attached[parent]) attach(child, attached[parent]);
+}
+
+/* pid stored to logical address l_addr: if that is in its text, the compiled code is stale */
+void aot_text_write(int pid, int l_addr)
+{
+    if (pid < 0 || pid >= attached_cap || !attached[pid]) return;
+    if (l_addr < 0 || l_addr >= attached[pid]->count) return;
+    detach(pid);
+    text_writes++;
+}
+
+void aot_release(int pid)
+{
+    detach(pid);
+}
+
+static int op_read(struct aot_cpu *c, int l_addr)
+{
+    int v = cpu_data_read(l_addr);
+    if (get_current_pid() != running_pid) c->stop = AOT_STOPPED; /* faulted */
+    return v;
+}
+
+static void op_write(struct aot_cpu *c, int l_addr, int value)
+{
+    cpu_data_write(l_addr, value);
+    if (get_current_pid() != running_pid || !attached[running_pid]) c->stop = AOT_STOPPED;
+}
+
+/**
+ * run the current process as compiled code for at most max_cycles
+ * instructions. returns the cycles used, 0 if the caller should run
+ * clock_cycle() instead; *status is what clock_cycle() would have returned
+ */
+int aot_run(int max_cycles, int *status)
+{
+    if (max_cycles <= 0 || timing_enabled || heatmap_enabled || lineprof_enabled || demand_pending) return 0;
+    int pid = get_current_pid();
+    if (pid < 0 || pid >= attached_cap || !attached[pid]) return 0;
+    struct aot_module *m = attached[pid];
+    if (PC < 0 || PC >= m->count) return 0;
+
+    struct aot_cpu c = { AC, MAR, MBR, SP, -1, AOT_RUNNING, max_cycles, op_read, op_write };
+    running_pid = pid;
+    int pc = m->entry(&c, PC);
+    running_pid = -1;
+    if (c.last < 0) return 0; /* yielded before its first instruction */
+
+    AC = c.ac;
+    MAR = c.mar;
+    MBR = c.mbr;
+    SP = c.sp;
+    PC = pc;
+    IR0 = m->text[c.last][0];
+    IR1 = m->text[c.last][1];
+    if (c.stop == AOT_EXIT) *status = 0;
+    else *status = get_current_pid() == pid ? 1 : CPU_SWITCH;
+
+    int ran = (int)(max_cycles - c.budget);
+    runs++;
+    native_instructions += ran;
+    cpu_instructions += ran;
+    stops[c.stop]++;
+    return ran;
+}
+
+void print_aot_stats(void)
+{
+    printf("AOT: %d programs compiled, %d loaded from %s, %d reused in memory, %d failed\n",
+           compiled, cache_hits, aot_cache_dir, shared, failed);
+    printf("AOT: %ld instructions in %ld native runs; ended by quantum %ld, exit %ld, fault or text write %ld, "
+           "leaving compiled code %ld; %d processes fell back after writing their text\n",
+           native_instructions, runs, stops[AOT_QUANTUM], stops[AOT_EXIT], stops[AOT_STOPPED],
+           stops[AOT_LEAVE], text_writes);
+}
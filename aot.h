@@ -0,0 +1,20 @@
+/**
+ * aot.h
+ * Ahead-of-time compilation of guest programs to native code.
+ */
+#ifndef AOT_H
+#define AOT_H
+
+extern int aot_enabled;
+extern int aot_active;
+extern char aot_cache_dir[];
+extern char aot_cc[];
+
+void aot_attach(int pid, int (*text)[2], int count);
+void aot_fork(int parent, int child);
+void aot_text_write(int pid, int l_addr);
+void aot_release(int pid);
+int aot_run(int max_cycles, int *status);
+void print_aot_stats(void);
+
+#endif
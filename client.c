@@ -0,0 +1,83 @@
+/**
+ * client.c
+ * Local client for the simulator daemon (server.c).
+ *
+ * Sends one request per argument: a program list file becomes
+ * "list <absolute path>", "-" forwards standard input as raw requests
+ * (prog/image/list lines) and "shutdown" stops the daemon. Then it closes
+ * its side of the connection and prints the replies until the server
+ * reports "done".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "client.h"
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n <= 0) return 0;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+/**
+ * submit the requests in args to the daemon listening on path and print
+ * its replies. returns 0 if every job exited normally, 1 otherwise
+ */
+int client_submit(const char *path, int nargs, char **args)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "client: socket path %s is too long\n", path);
+        return 1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "client: cannot connect to %s\n", path);
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+
+    int ok = 1;
+    char line[PATH_MAX + 16];
+    for (int i = 0; i < nargs && ok; ++i) {
+        if (strcmp(args[i], "-") == 0) {
+            while (ok && fgets(line, sizeof(line), stdin)) ok = send_all(fd, line, strlen(line));
+        } else if (strcmp(args[i], "shutdown") == 0) {
+            ok = send_all(fd, "shutdown\n", 9);
+        } else {
+            /* the daemon may run in another directory */
+            char full[PATH_MAX];
+            const char *list = realpath(args[i], full) ? full : args[i];
+            snprintf(line, sizeof(line), "list %s\n", list);
+            ok = send_all(fd, line, strlen(line));
+        }
+    }
+    shutdown(fd, SHUT_WR);
+
+    int failed = !ok;
+    FILE *in = fdopen(fd, "r");
+    if (!in) {
+        close(fd);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), in)) {
+        fputs(line, stdout);
+        fflush(stdout);
+        if (strncmp(line, "error", 5) == 0 || strstr(line, " fault ")) failed = 1;
+    }
+    fclose(in);
+    return failed;
+}
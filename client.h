@@ -0,0 +1,10 @@
+/**
+ * client.h
+ * Local client for the simulator daemon (server.c).
+ */
+#ifndef CLIENT_H
+#define CLIENT_H
+
+int client_submit(const char *path, int nargs, char **args);
+
+#endif
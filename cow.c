@@ -0,0 +1,271 @@
+/**
+ * cow.c
+ * spawn: child processes that share their parent's partition copy-on-write.
+ *
+ * A spawned child gets a PCB but no partition of its own. Its page map
+ * points every COW_PAGE_WORDS-word page at the owner's partition (the
+ * process whose memory is shared); mem_read()/mem_write() translate the
+ * child's accesses through it. The first write to a shared page copies
+ * it into a private frame taken straight from the SMM hole list. When the
+ * owner writes a page, or exits, children still sharing those pages get
+ * their private copies first, so they never see the owner's later
+ * changes. Words in a shared text segment are never part of a page map:
+ * the child maps the same segment and text.c translates them first.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cow.h"
+#include "cpu.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "smm.h"
+#include "demand.h"
+#include "table.h"
+#include "text.h"
+#include "lineprof.h"
+#include "aot.h"
+
+int cow_active = 0; /* number of live COW children; 0 keeps memory.c on the plain path */
+
+struct cow_map {
+    int owner;   /* PID whose partition is shared */
+    int base;    /* owner's base when the child was spawned */
+    int size;
+    int first;   /* logical words below this are shared text, not copied */
+    int npages;
+    int *frame;  /* per page: physical base of the private copy, -1 while shared */
+};
+
+struct cow_owner {
+    int *children;
+    int count, cap;
+};
+
+static struct cow_map **maps = NULL;     /* by child PID */
+static struct cow_owner *owners = NULL;  /* by owner PID */
+static int maps_cap = 0, owners_cap = 0;
+
+static long spawns = 0, pages_copied = 0;
+
+static struct cow_map *map_of(int pid)
+{
+    return (pid >= 0 && pid < maps_cap) ? maps[pid] : NULL;
+}
+
+static int page_words(struct cow_map *m, int k)
+{
+    int left = m->size - k * COW_PAGE_WORDS;
+    return left < COW_PAGE_WORDS ? left : COW_PAGE_WORDS;
+}
+
+/* give child m a private copy of page k; returns 0 if memory is full */
+static int copy_page(struct cow_map *m, int k)
+{
+    if (m->frame[k] >= 0) return 1;
+    int words = page_words(m, k);
+    int frame = find_hole(words);
+    if (frame < 0) return 0;
+
+    int skip = m->first - k * COW_PAGE_WORDS; /* text at the start of the page */
+    if (skip < 0) skip = 0;
+    if (skip < words) {
+        int buf[COW_PAGE_WORDS][2];
+        mem_copy_out(m->base + k * COW_PAGE_WORDS + skip, buf, words - skip);
+        mem_copy_in(frame + skip, buf, words - skip);
+    }
+    m->frame[k] = frame;
+    pages_copied++;
+    return 1;
+}
+
+static void owner_add(int owner, int child)
+{
+    if (!table_reserve((void **)&owners, &owners_cap, owner, sizeof(*owners))) return;
+    struct cow_owner *o = &owners[owner];
+    if (!table_reserve((void **)&o->children, &o->cap, o->count, sizeof(int))) return;
+    o->children[o->count++] = child;
+}
+
+static void owner_remove(int owner, int child)
+{
+    if (owner < 0 || owner >= owners_cap) return;
+    struct cow_owner *o = &owners[owner];
+    for (int i = 0; i < o->count; ++i) {
+        if (o->children[i] == child) {
+            o->children[i] = o->children[--o->count];
+            return;
+        }
+    }
+}
+
+/**
+ * spawn instruction: create a child of the running process that continues
+ * after the spawn with AC = 0 and shares the partition copy-on-write.
+ * returns the parent's new AC: child PID + 1 (never 0, since PID 0
+ * exists) or -1
+ */
+int cow_spawn(void)
+{
+    int parent = get_current_pid();
+    if (parent < 0) return -1;
+
+    struct cow_map *pm = map_of(parent);
+    int owner = pm ? pm->owner : parent;
+    PCB *pp = scheduler_get_pcb(parent);
+    if (!pp || (!pm && get_base_address(parent) < 0)) return -1;
+    int base = pm ? pm->base : pp->base; /* below the partition if the text is shared */
+    int size = pp->size;
+
+    /* the child reads the owner's memory directly, so it must be complete */
+    if (!pm && demand_pending) {
+        for (int l = 0; l < size; l += DEMAND_PAGE_WORDS) demand_touch(parent, base, l);
+    }
+
+    int child = scheduler_get_free_pid();
+    if (child < 0 || !table_reserve((void **)&maps, &maps_cap, child, sizeof(*maps))) return -1;
+
+    struct cow_map *m = (struct cow_map *)malloc(sizeof(*m));
+    int npages = (size + COW_PAGE_WORDS - 1) / COW_PAGE_WORDS;
+    int *frame = m ? (int *)malloc((npages + 1) * sizeof(int)) : NULL;
+    if (!m || !frame) {
+        fprintf(stderr, "cow_spawn: out of memory\n");
+        free(m);
+        return -1;
+    }
+    m->owner = owner;
+    m->base = base;
+    m->size = size;
+    m->first = text_words(parent);
+    m->npages = npages;
+    m->frame = frame;
+    for (int k = 0; k < npages; ++k) m->frame[k] = -1;
+
+    /* pages the parent already owns privately are not the owner's: copy them now */
+    if (pm) {
+        for (int k = 0; k < npages; ++k) {
+            if (pm->frame[k] < 0) continue;
+            int words = page_words(m, k);
+            int f = find_hole(words);
+            if (f < 0) {
+                fprintf(stderr, "cow_spawn: no memory for a private page\n");
+                for (int j = 0; j < k; ++j) if (m->frame[j] >= 0) add_hole(m->frame[j], page_words(m, j));
+                free(m->frame);
+                free(m);
+                return -1;
+            }
+            int buf[COW_PAGE_WORDS][2];
+            mem_copy_out(pm->frame[k], buf, words);
+            mem_copy_in(f, buf, words);
+            m->frame[k] = f;
+            pages_copied++;
+        }
+    }
+
+    maps[child] = m;
+    owner_add(owner, child);
+    cow_active++;
+
+    text_fork(parent, child);
+    create_process_with_pid(child, base, size);
+    if (lineprof_enabled) lineprof_fork(parent, child);
+    if (aot_active) aot_fork(parent, child);
+    PCB *c = scheduler_get_pcb(child);
+    if (c) {
+        c->pc = (uint32_t)(PC + 1);
+        c->registers[0] = 0;
+        c->registers[1] = (uint32_t)MAR;
+        c->registers[2] = (uint32_t)MBR;
+        c->registers[3] = (uint32_t)IR0;
+        c->registers[4] = (uint32_t)IR1;
+        c->sp = (uint32_t)SP;
+    }
+    spawns++;
+    return child + 1;
+}
+
+/**
+ * translate physical address addr as seen by COW child pid. a write to a
+ * shared page copies it first. returns the address to use, or -1 if pid
+ * is not a COW child, addr is outside its partition or no frame is free
+ */
+int cow_translate(int pid, int addr, int write)
+{
+    struct cow_map *m = map_of(pid);
+    if (!m) return -1;
+    int off = addr - m->base;
+    if (off < 0 || off >= m->size) return -1;
+
+    int k = off / COW_PAGE_WORDS;
+    if (m->frame[k] >= 0) return m->frame[k] + off % COW_PAGE_WORDS;
+    if (!write) return addr;
+    if (!copy_page(m, k)) {
+        fprintf(stderr, "cow: no memory to copy page %d for PID %d\n", k, pid);
+        return -1;
+    }
+    return m->frame[k] + off % COW_PAGE_WORDS;
+}
+
+/* the owner is about to write addr: children still sharing that page copy it first */
+void cow_owner_write(int pid, int addr)
+{
+    if (pid < 0 || pid >= owners_cap || owners[pid].count == 0) return;
+    struct cow_owner *o = &owners[pid];
+    for (int i = 0; i < o->count; ++i) {
+        struct cow_map *m = maps[o->children[i]];
+        int off = addr - m->base;
+        if (off < 0 || off >= m->size) continue;
+        if (!copy_page(m, off / COW_PAGE_WORDS)) {
+            fprintf(stderr, "cow: no memory to copy page for PID %d\n", o->children[i]);
+        }
+    }
+}
+
+/* number of live children sharing pid's partition (such a partition must not move) */
+int cow_sharers(int pid)
+{
+    return (pid >= 0 && pid < owners_cap) ? owners[pid].count : 0;
+}
+
+/**
+ * pid is going away: free its private frames if it is a child; if it is
+ * an owner, give its children private copies of everything they still
+ * share. must run before the owner's partition is deallocated
+ */
+void cow_release(int pid)
+{
+    struct cow_map *m = map_of(pid);
+    if (m) {
+        for (int k = 0; k < m->npages; ++k) {
+            if (m->frame[k] >= 0) add_hole(m->frame[k], page_words(m, k));
+        }
+        owner_remove(m->owner, pid);
+        free(m->frame);
+        free(m);
+        maps[pid] = NULL;
+        cow_active--;
+    }
+
+    while (cow_sharers(pid) > 0) {
+        struct cow_owner *o = &owners[pid];
+        int child = o->children[o->count - 1];
+        struct cow_map *cm = maps[child];
+        for (int k = 0; k < cm->npages; ++k) {
+            if ((k + 1) * COW_PAGE_WORDS <= cm->first) continue; /* all text */
+            if (!copy_page(cm, k)) {
+                fprintf(stderr, "cow: no memory to detach PID %d - terminating process\n", child);
+                cow_release(child);
+                remove_process_from_ready(child);
+                break;
+            }
+        }
+        owner_remove(pid, child);
+        if (maps[child]) maps[child]->owner = -1; /* fully private now */
+    }
+}
+
+void print_cow_stats(void)
+{
+    printf("COW: %ld spawns, %ld pages copied\n", spawns, pages_copied);
+}
@@ -0,0 +1,19 @@
+/**
+ * cow.h
+ * spawn: child processes that share their parent's partition copy-on-write.
+ */
+#ifndef COW_H
+#define COW_H
+
+#define COW_PAGE_WORDS 16
+
+extern int cow_active;
+
+int cow_spawn(void);
+int cow_translate(int pid, int addr, int write);
+void cow_owner_write(int pid, int addr);
+int cow_sharers(int pid);
+void cow_release(int pid);
+void print_cow_stats(void);
+
+#endif
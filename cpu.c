@@ -6,6 +6,13 @@
 
 #include "cpu.h"
 #include "memory.h"
+#include "scheduler.h"
+#include "demand.h"
+#include "timing.h"
+#include "cow.h"
+#include "heatmap.h"
+#include "lineprof.h"
+#include "aot.h"
 
 int Base = 0;
 int PC = 0;
@@ -14,6 +21,16 @@ int IR1 = 0;
 int AC = 0;
 int MAR = 0;
 int MBR = 0;
+int SP = 0;  /* logical address of the top of the stack, which grows down */
+long long cpu_instructions = 0;
+
+static int verified = 0; /* running process is PCB_VERIFIED: skip permission checks */
+
+/* the scheduler loaded a process; its accesses need no checks if it is verified */
+void cpu_set_verified(int v)
+{
+    verified = v;
+}
 
 /**
  * required func to define for project 1
@@ -31,7 +48,10 @@ int mem_address(int l_addr)
  */
 void fetch_instruction(int addr)
 {
-    int *slot = mem_read(addr);
+    if (demand_pending) demand_touch(get_current_pid(), Base, addr - Base);
+    if (timing_enabled) timing_access(get_current_pid(), addr);
+    if (heatmap_enabled) heatmap_access(get_current_pid(), addr - Base, 0);
+    int *slot = verified ? mem_read_verified(addr) : mem_read(addr);
     if (slot == NULL) {
         IR0 = 0; IR1 = 0;
         return;
@@ -40,6 +60,30 @@ void fetch_instruction(int addr)
     IR1 = slot[1];
 }
 
+/* data read at logical address l_addr by the running process; 0 if it faulted */
+int cpu_data_read(int l_addr)
+{
+    int phys = mem_address(l_addr);
+    if (demand_pending) demand_touch(get_current_pid(), Base, l_addr);
+    if (timing_enabled) timing_access(get_current_pid(), phys);
+    if (heatmap_enabled) heatmap_access(get_current_pid(), l_addr, 0);
+    int *slot = verified ? mem_read_verified(phys) : mem_read(phys);
+    return slot ? slot[0] : 0;
+}
+
+/* data write by the running process; a fault terminates it */
+void cpu_data_write(int l_addr, int value)
+{
+    int phys = mem_address(l_addr);
+    if (demand_pending) demand_touch(get_current_pid(), Base, l_addr); /* or the page load would overwrite it */
+    if (timing_enabled) timing_access(get_current_pid(), phys);
+    if (heatmap_enabled) heatmap_access(get_current_pid(), l_addr, 1);
+    if (aot_active) aot_text_write(get_current_pid(), l_addr); /* its compiled code would be stale */
+    int data[2] = {value, 0};
+    if (verified) mem_write_verified(phys, data);
+    else mem_write(phys, data);
+}
+
 /**
  * required func to define for project 1
  * execute the instruction in IR0/IR1
@@ -58,6 +102,19 @@ void fetch_instruction(int addr)
  * 11 or            -> AC = (AC!=0 || MBR!=0) ? 1 : 0
  * 12 ifgo addr     -> if (AC != 0) PC = addr - 1
  * 13 sleep         -> do nothing
+ * 14 spawn         -> child process continues after the spawn with AC = 0,
+ *                     sharing the partition copy-on-write; parent AC = child PID + 1 (-1 on failure)
+ * 15 add_imm n     -> AC += n
+ * 16 dbnz addr     -> AC -= 1; if (AC != 0) PC = addr
+ * 17 load_from n   -> AC = memory[ mem_address(n) ]
+ * 18 store_to n    -> memory[ mem_address(n) ] = AC
+ * 19 load_idx n    -> AC = memory[ mem_address(MAR + n) ]
+ * 20 store_idx n   -> memory[ mem_address(MAR + n) ] = AC
+ * 21 push          -> memory[ mem_address(--SP) ] = AC
+ * 22 pop           -> AC = memory[ mem_address(SP++) ]
+ * 23 call addr     -> push PC + 1; PC = addr
+ * 24 ret           -> PC = pop
+ * SP starts at the end of the partition, so the stack sits above the program's data
  */
 void execute_instruction(void)
 {
@@ -91,22 +148,14 @@ void execute_instruction(void)
             break;
 
         case 6: /* load_at_addr: use MAR as logical address */
-        {
-            int phys = mem_address(MAR);
-            int *slot = mem_read(phys);
-            if (slot) MBR = slot[0]; else MBR = 0;
+            MBR = cpu_data_read(MAR);
             PC++;
             break;
-        }
 
         case 7: /* write_at_addr: write MBR into memory at MAR */
-        {
-            int phys = mem_address(MAR);
-            int data[2] = {MBR, 0};
-            mem_write(phys, data);
+            cpu_data_write(MAR, MBR);
             PC++;
             break;
-        }
 
         case 8: /* add */
             AC = AC + MBR;
@@ -139,6 +188,69 @@ void execute_instruction(void)
             PC++;
             break;
 
+        case 14: /* spawn */
+            AC = cow_spawn();
+            PC++;
+            break;
+
+        case 15: /* add_imm */
+            AC = AC + IR1;
+            PC++;
+            break;
+
+        case 16: /* dbnz addr */
+            AC = AC - 1;
+            if (AC != 0) {
+                PC = IR1 - 1;
+            }
+            PC++;
+            break;
+
+        case 17: /* load_from n */
+            AC = cpu_data_read(IR1);
+            PC++;
+            break;
+
+        case 18: /* store_to n */
+            cpu_data_write(IR1, AC);
+            PC++;
+            break;
+
+        case 19: /* load_idx n */
+            AC = cpu_data_read(MAR + IR1);
+            PC++;
+            break;
+
+        case 20: /* store_idx n */
+            cpu_data_write(MAR + IR1, AC);
+            PC++;
+            break;
+
+        case 21: /* push */
+            SP--;
+            cpu_data_write(SP, AC);
+            PC++;
+            break;
+
+        case 22: /* pop */
+            AC = cpu_data_read(SP);
+            SP++;
+            PC++;
+            break;
+
+        case 23: /* call addr */
+            SP--;
+            cpu_data_write(SP, PC + 1);
+            PC = IR1;
+            if (lineprof_enabled) lineprof_call(get_current_pid(), IR1);
+            break;
+
+        case 24: /* ret */
+            PC = cpu_data_read(SP);
+            SP++;
+            if (lineprof_enabled) lineprof_ret(get_current_pid());
+            break;
+
         default:
             fprintf(stderr, "Error: invalid opcode %d\n", IR0);
             PC++;
@@ -153,15 +265,20 @@ void execute_instruction(void)
  */
 int clock_cycle(void)
 {
+    if (get_current_pid() < 0) return CPU_SWITCH; /* the registers belong to a terminated process */
     int abs_addr = mem_address(PC);
     fetch_instruction(abs_addr);
+    if (timing_enabled) timing_instruction(IR0);
+    if (lineprof_enabled) lineprof_sample(get_current_pid(), PC);
+    if (get_current_pid() < 0) return CPU_SWITCH; /* the fetch faulted */
+    cpu_instructions++;
 
     if (IR0 == 0) {
         return 0;
     }
 
     execute_instruction();
-    return 1;
+    return get_current_pid() < 0 ? CPU_SWITCH : 1; /* it faulted: end its quantum here */
 }
 
 /**
@@ -180,6 +297,7 @@ register_struct context_switch(register_struct new_vals)
     old_vals.AC = AC;
     old_vals.MAR = MAR;
     old_vals.MBR = MBR;
+    old_vals.SP = SP;
 
     Base = new_vals.Base;
     PC = new_vals.PC;
@@ -188,6 +306,7 @@ register_struct context_switch(register_struct new_vals)
     AC = new_vals.AC;
     MAR = new_vals.MAR;
     MBR = new_vals.MBR;
+    SP = new_vals.SP;
 
     return old_vals;
 }
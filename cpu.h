@@ -11,11 +11,17 @@ extern int IR1;
 extern int AC;
 extern int MAR;
 extern int MBR;
+extern int SP;
+extern long long cpu_instructions; /* executed so far, by the CPU or any engine standing in for it */
 
 void fetch_instruction(int addr);
 void execute_instruction(void);
 int mem_address(int l_addr);
+int cpu_data_read(int l_addr);
+void cpu_data_write(int l_addr, int value);
 int clock_cycle(void);
+#define CPU_SWITCH 2 /* clock_cycle(): the running process was terminated, switch now */
+void cpu_set_verified(int v);
 
 typedef struct register_struct {
 	int Base;
@@ -25,6 +31,7 @@ typedef struct register_struct {
 	int AC;
 	int MAR;
 	int MBR;
+	int SP;
 } register_struct;
 
 register_struct context_switch(register_struct new_vals);
@@ -0,0 +1,190 @@
+/**
+ * demand.c
+ * Demand loading of program text, one page at a time on first touch.
+ *
+ * Admission only reserves the partition and records the program file.
+ * The first fetch, load or store that touches a page of
+ * DEMAND_PAGE_WORDS words translates that page from the file and writes
+ * it into the partition. File offsets of page starts are remembered as
+ * the file is scanned, so later faults seek straight to their page.
+ * Once every page holding text is in, the words that were placed are
+ * handed to the verifier and the AOT compiler, the state is dropped and
+ * the process goes back to the plain path.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "demand.h"
+#include "disk.h"
+#include "memory.h"
+#include "loopsum.h"
+#include "scheduler.h"
+#include "table.h"
+#include "cpu.h"
+#include "verify.h"
+#include "aot.h"
+
+int demand_enabled = 1;  /* set to 0 to load the whole program at admission */
+int demand_pending = 0;  /* processes that still have pages to load */
+
+struct lazy_text {
+    char *fname;
+    int size;              /* words in the partition */
+    int pages;             /* pages that may hold text */
+    int count;             /* text words placed so far */
+    int (*image)[2];       /* copy of what was placed, size words */
+    int known;             /* page_off[0..known-1] are valid */
+    long *page_off;        /* file offset of the first line of each page */
+    unsigned char *valid;  /* one bit per loaded page */
+};
+
+static struct lazy_text **lazy = NULL; /* by PID */
+static int lazy_cap = 0;
+
+static int page_valid(struct lazy_text *lt, int k)
+{
+    return (lt->valid[k / 8] >> (k % 8)) & 1;
+}
+
+/**
+ * reserve lazy loading state for pid, whose partition is `size` words.
+ * returns 0 if the program cannot be opened
+ */
+int demand_register(int pid, char *fname, int size)
+{
+    if (!table_reserve((void **)&lazy, &lazy_cap, pid, sizeof(*lazy))) return 0;
+    FILE *f = fopen(fname, "r");
+    if (!f) {
+        fprintf(stderr, "Error opening program file %s\n", fname);
+        return 0;
+    }
+    fclose(f);
+
+    demand_release(pid);
+    int pages = (size + DEMAND_PAGE_WORDS - 1) / DEMAND_PAGE_WORDS;
+    struct lazy_text *lt = (struct lazy_text *)calloc(1, sizeof(*lt));
+    if (lt) {
+        lt->fname = strdup(fname);
+        lt->page_off = (long *)calloc(pages + 1, sizeof(long));
+        lt->valid = (unsigned char *)calloc(pages / 8 + 1, 1);
+        lt->image = (int (*)[2])malloc((size > 0 ? size : 1) * sizeof(lt->image[0]));
+    }
+    if (!lt || !lt->fname || !lt->page_off || !lt->valid || !lt->image) {
+        fprintf(stderr, "demand_register: out of memory\n");
+        if (lt) { free(lt->fname); free(lt->page_off); free(lt->valid); free(lt->image); free(lt); }
+        return 0;
+    }
+    lt->size = size;
+    lt->pages = pages;
+    lt->known = 1; /* page 0 starts at offset 0 */
+    lazy[pid] = lt;
+    demand_pending++;
+    return 1;
+}
+
+/* translate page k from the file and write it at base; learns page offsets on the way */
+static void load_page(struct lazy_text *lt, int base, int k)
+{
+    int prog[DEMAND_PAGE_WORDS][2];
+    int n = 0;
+
+    FILE *f = fopen(lt->fname, "r");
+    if (!f) {
+        fprintf(stderr, "Error opening program file %s\n", lt->fname);
+        lt->valid[k / 8] |= 1 << (k % 8);
+        return;
+    }
+
+    int page = k < lt->known ? k : lt->known - 1;
+    fseek(f, lt->page_off[page], SEEK_SET);
+    int idx = page * DEMAND_PAGE_WORDS;
+    int at_eof = 1;
+    char line[512];
+    long pos = ftell(f);
+    while (fgets(line, sizeof(line), f)) {
+        int *t = translate(line);
+        if (t) {
+            int pg = idx / DEMAND_PAGE_WORDS;
+            if (idx % DEMAND_PAGE_WORDS == 0 && pg == lt->known && pg < lt->pages) {
+                lt->page_off[lt->known++] = pos;
+            }
+            if (pg > k) {
+                at_eof = 0;
+                break;
+            }
+            if (pg == k) {
+                prog[n][0] = t[0];
+                prog[n][1] = t[1];
+                n++;
+            }
+            idx++;
+        }
+        pos = ftell(f);
+    }
+    fclose(f);
+
+    if (at_eof) {
+        /* pages past the end of the text never need loading */
+        int text_pages = (idx + DEMAND_PAGE_WORDS - 1) / DEMAND_PAGE_WORDS;
+        if (text_pages < lt->pages) lt->pages = text_pages;
+    }
+
+    int first = k * DEMAND_PAGE_WORDS;
+    if (n > lt->size - first) n = lt->size - first; /* never spill into the neighbouring partition */
+    if (n > 0) {
+        mem_copy_in(base + first, prog, n);
+        memcpy(lt->image + first, prog, n * sizeof(prog[0]));
+        if (first + n > lt->count) lt->count = first + n;
+        loopsum_analyze(base, first, prog, n);
+    }
+    lt->valid[k / 8] |= 1 << (k % 8);
+}
+
+/**
+ * every page of pid is in: the process has so far run exactly this text,
+ * so it gets PCB_VERIFIED if the verifier proves it, like a process whose
+ * text was loaded at admission
+ */
+static void text_complete(int pid, struct lazy_text *lt)
+{
+    PCB *p = scheduler_get_pcb(pid);
+    if (p && verify_program(lt->image, lt->count, lt->size)) {
+        p->flags |= PCB_VERIFIED;
+        if (pid == get_current_pid()) cpu_set_verified(1);
+    }
+    aot_attach(pid, lt->image, lt->count);
+}
+
+/**
+ * make sure the page holding logical address l_addr of pid (partition at
+ * base) is loaded. cheap when pid has nothing left to load
+ */
+void demand_touch(int pid, int base, int l_addr)
+{
+    if (pid < 0 || pid >= lazy_cap || l_addr < 0) return;
+    struct lazy_text *lt = lazy[pid];
+    if (!lt) return;
+    int k = l_addr / DEMAND_PAGE_WORDS;
+    if (k >= lt->pages || page_valid(lt, k)) return;
+
+    load_page(lt, base, k);
+
+    for (int i = 0; i < lt->pages; ++i) {
+        if (!page_valid(lt, i)) return;
+    }
+    text_complete(pid, lt);
+    demand_release(pid); /* everything is in */
+}
+
+void demand_release(int pid)
+{
+    if (pid < 0 || pid >= lazy_cap || !lazy[pid]) return;
+    free(lazy[pid]->fname);
+    free(lazy[pid]->page_off);
+    free(lazy[pid]->valid);
+    free(lazy[pid]->image);
+    free(lazy[pid]);
+    lazy[pid] = NULL;
+    demand_pending--;
+}
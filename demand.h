@@ -0,0 +1,17 @@
+/**
+ * demand.h
+ * Demand loading of program text, one page at a time on first touch.
+ */
+#ifndef DEMAND_H
+#define DEMAND_H
+
+#define DEMAND_PAGE_WORDS 16
+
+extern int demand_enabled;
+extern int demand_pending;
+
+int demand_register(int pid, char *fname, int size);
+void demand_touch(int pid, int base, int l_addr);
+void demand_release(int pid);
+
+#endif
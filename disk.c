@@ -9,6 +9,15 @@
 #include "disk.h"
 #include "memory.h"
 #include "smm.h"
+#include "loopsum.h"
+#include "swap.h"
+#include "scheduler.h"
+#include "admit.h"
+#include "demand.h"
+#include "text.h"
+#include "lineprof.h"
+#include "verify.h"
+#include "aot.h"
 
 // translation buffer
 static int translation[2];
@@ -26,81 +35,300 @@ static char *trim(char *s)
 }
 
 /**
- * required func to define for project 1
- * translate textual instruction into opcode+arg.
- * lines starting with '//' or empty after trimming return NULL.
+ * reentrant core of translate(): writes opcode+arg into out and returns 1,
+ * or returns 0 for comments, blank lines and unknown instructions.
+ * safe to call from several threads
  */
-int* translate(char *instruction)
+int translate_into(char *instruction, int out[2])
 {
-    if (instruction == NULL) return NULL;
+    if (instruction == NULL) return 0;
     char buf[256];
     strncpy(buf, instruction, sizeof(buf)-1);
     buf[sizeof(buf)-1] = '\0';
     char *s = trim(buf);
-    if (*s == '\0') return NULL;
-    if (s[0] == '/' && s[1] == '/') return NULL;
+    if (*s == '\0') return 0;
+    if (s[0] == '/' && s[1] == '/') return 0;
 
     /* Tokenize */
-    char *tok = strtok(s, " \t\n\r");
-    if (!tok) return NULL;
+    char *save = NULL;
+    char *tok = strtok_r(s, " \t\n\r", &save);
+    if (!tok) return 0;
     /* lowercase opcode for comparison */
     for (char *p = tok; *p; ++p) *p = tolower((unsigned char)*p);
 
     if (strcmp(tok, "exit") == 0) {
-        translation[0] = 0; translation[1] = 0; return translation;
+        out[0] = 0; out[1] = 0; return 1;
     }
     if (strcmp(tok, "load_const") == 0) {
-        char *arg = strtok(NULL, " \t\n\r");
-        translation[0] = 1;
-        translation[1] = arg ? atoi(arg) : 0;
-        return translation;
+        char *arg = strtok_r(NULL, " \t\n\r", &save);
+        out[0] = 1;
+        out[1] = arg ? atoi(arg) : 0;
+        return 1;
+    }
+    if (strcmp(tok, "move_from_mbr")    == 0) { out[0]=2; out[1]=0; return 1; }
+    if (strcmp(tok, "move_from_mar")    == 0) { out[0]=3; out[1]=0; return 1; }
+    if (strcmp(tok, "move_to_mbr")      == 0) { out[0]=4; out[1]=0; return 1; }
+    if (strcmp(tok, "move_to_mar")      == 0) { out[0]=5; out[1]=0; return 1; }
+    if (strcmp(tok, "load_at_addr")     == 0) { out[0]=6; out[1]=0; return 1; }
+    if (strcmp(tok, "write_at_addr")    == 0) { out[0]=7; out[1]=0; return 1; }
+    if (strcmp(tok, "add")              == 0) { out[0]=8; out[1]=0; return 1; }
+    if (strcmp(tok, "multiply")         == 0) { out[0]=9; out[1]=0; return 1; }
+    if (strcmp(tok, "and")              == 0) { out[0]=10; out[1]=0; return 1; }
+    if (strcmp(tok, "or")               == 0) { out[0]=11; out[1]=0; return 1; }
+    if (strcmp(tok, "ifgo")             == 0) { char *arg = strtok_r(NULL, " \t\n\r", &save); out[0]=12; out[1] = arg ? atoi(arg) : 0; return 1; }
+    if (strcmp(tok, "sleep")            == 0) { out[0]=13; out[1]=0; return 1; }
+    if (strcmp(tok, "spawn")            == 0) { out[0]=14; out[1]=0; return 1; }
+
+    /* extensions: one instruction where the original ISA needs several */
+    static const struct { const char *name; int op; int has_arg; } ext[] = {
+        {"add_imm", 15, 1}, {"dbnz", 16, 1},
+        {"load_from", 17, 1}, {"store_to", 18, 1},
+        {"load_idx", 19, 1}, {"store_idx", 20, 1},
+        {"push", 21, 0}, {"pop", 22, 0}, {"call", 23, 1}, {"ret", 24, 0},
+    };
+    for (size_t i = 0; i < sizeof(ext) / sizeof(ext[0]); ++i) {
+        if (strcmp(tok, ext[i].name) != 0) continue;
+        char *arg = ext[i].has_arg ? strtok_r(NULL, " \t\n\r", &save) : NULL;
+        out[0] = ext[i].op;
+        out[1] = arg ? atoi(arg) : 0;
+        return 1;
     }
-    if (strcmp(tok, "move_from_mbr")    == 0) { translation[0]=2; translation[1]=0; return translation; }
-    if (strcmp(tok, "move_from_mar")    == 0) { translation[0]=3; translation[1]=0; return translation; }
-    if (strcmp(tok, "move_to_mbr")      == 0) { translation[0]=4; translation[1]=0; return translation; }
-    if (strcmp(tok, "move_to_mar")      == 0) { translation[0]=5; translation[1]=0; return translation; }
-    if (strcmp(tok, "load_at_addr")     == 0) { translation[0]=6; translation[1]=0; return translation; }
-    if (strcmp(tok, "write_at_addr")    == 0) { translation[0]=7; translation[1]=0; return translation; }
-    if (strcmp(tok, "add")              == 0) { translation[0]=8; translation[1]=0; return translation; }
-    if (strcmp(tok, "multiply")         == 0) { translation[0]=9; translation[1]=0; return translation; }
-    if (strcmp(tok, "and")              == 0) { translation[0]=10; translation[1]=0; return translation; }
-    if (strcmp(tok, "or")               == 0) { translation[0]=11; translation[1]=0; return translation; }
-    if (strcmp(tok, "ifgo")             == 0) { char *arg = strtok(NULL, " \t\n\r"); translation[0]=12; translation[1] = arg ? atoi(arg) : 0; return translation; }
-    if (strcmp(tok, "sleep")            == 0) { translation[0]=13; translation[1]=0; return translation; }
-
-    return NULL;
+
+    return 0;
 }
 
 /**
  * required func to define for project 1
- * load the program
- * calls translate for each line
- * if translate returns non-null, write to memory at addr using mem_write
+ * translate textual instruction into opcode+arg.
+ * lines starting with '//' or empty after trimming return NULL.
  */
-void load_prog(char *fname, int addr)
+int* translate(char *instruction)
+{
+    return translate_into(instruction, translation) ? translation : NULL;
+}
+
+/**
+ * load_prog() that hands back a malloc'd copy of the count words it
+ * wrote (NULL if there is none), for the verifier and the AOT compiler
+ */
+static int (*load_text(char *fname, int addr, int size, int *count))[2]
 {
+    *count = 0;
     FILE *f = fopen(fname, "r");
     if (!f) {
         fprintf(stderr, "Error opening program file %s\n", fname);
-        return;
+        return NULL;
     }
 
     char line[512];
     int cur = addr;
-    while (fgets(line, sizeof(line), f)) {
+    int (*prog)[2] = NULL; /* copy of the text for the loop analyzer */
+    int cap = 0;
+    while (cur < addr + size && fgets(line, sizeof(line), f)) {
         int *t = translate(line);
         if (t) {
-            mem_write(cur, t);
+            /* loader writes are not checked against the running process */
+            mem_copy_in(cur, (int (*)[2])t, 1);
+            if (cur - addr == cap) {
+                cap = cap ? cap * 2 : 64;
+                int (*grown)[2] = realloc(prog, cap * sizeof(prog[0]));
+                if (!grown) { free(prog); prog = NULL; cap = 0; }
+                else prog = grown;
+            }
+            if (prog) {
+                prog[cur - addr][0] = t[0];
+                prog[cur - addr][1] = t[1];
+            }
             cur++;
         }
     }
 
     fclose(f);
+
+    if (prog) loopsum_analyze(addr, 0, prog, cur - addr);
+    *count = prog ? cur - addr : 0;
+    return prog;
+}
+
+/**
+ * required func to define for project 1
+ * load the program
+ * calls translate for each line
+ * if translate returns non-null, write to memory at addr with mem_copy_in,
+ * at most size words: the rest of the file is dropped rather than written
+ * into the neighbouring partition
+ */
+void load_prog(char *fname, int addr, int size)
+{
+    int count = 0;
+    free(load_text(fname, addr, size, &count));
+}
+
+/* translate a whole program file into a malloc'd buffer; NULL if it cannot be read */
+int (*read_image(char *fname, int *count))[2]
+{
+    FILE *f = fopen(fname, "r");
+    if (!f) {
+        fprintf(stderr, "Error opening program file %s\n", fname);
+        return NULL;
+    }
+
+    char line[512];
+    int (*prog)[2] = NULL;
+    int n = 0, cap = 0;
+    while (fgets(line, sizeof(line), f)) {
+        int ins[2];
+        if (!translate_into(line, ins)) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            int (*grown)[2] = realloc(prog, cap * sizeof(prog[0]));
+            if (!grown) {
+                fprintf(stderr, "read_image: out of memory for %s\n", fname);
+                free(prog);
+                fclose(f);
+                return NULL;
+            }
+            prog = grown;
+        }
+        prog[n][0] = ins[0];
+        prog[n][1] = ins[1];
+        n++;
+    }
+
+    fclose(f);
+    *count = n;
+    return prog;
+}
+
+/* pick a PID and allocate `size` words for it; returns the base,
+ * ADMIT_NO_ROOM if no hole is large enough right now, or -1 */
+#define ADMIT_NO_ROOM -2
+static int reserve_partition(char *fname, int size, int cycle_num, int *pid_out)
+{
+    /* Determine a free PID from the scheduler */
+    int pid = scheduler_get_free_pid();
+    if (pid < 0) {
+        fprintf(stderr, "  -> no free PID available for '%s'\n", fname);
+        return -1;
+    }
+
+    /* swap other processes out if no hole is big enough */
+    swap_make_room(size, pid, cycle_num);
+    if (!can_allocate(size) || !allocate(pid, size)) {
+        printf("  -> allocation of %d words for '%s' (PID %d) failed\n", size, fname, pid);
+        return ADMIT_NO_ROOM;
+    }
+
+    int base = get_base_address(pid);
+    if (base < 0) {
+        fprintf(stderr, "  -> internal error: allocation succeeded but base not found for PID %d\n", pid);
+        return -1;
+    }
+    printf("  -> allocated %d words at base %d for '%s' (PID %d)\n", size, base, fname, pid);
+    *pid_out = pid;
+    return base;
+}
+
+static int last_started = -1;
+
+/* create the process in the scheduler under the PID its partition was allocated for;
+ * proven: the verifier showed it never leaves the partition; text (count
+ * instructions, may be NULL) is what it runs, for the AOT compiler */
+static void start_process(char *fname, int pid, int base, int size, int proven, int (*text)[2], int count)
+{
+    create_process_with_pid(pid, base, size);
+    last_started = pid;
+    PCB *p = scheduler_get_pcb(pid);
+    if (p && proven) p->flags |= PCB_VERIFIED;
+    if (lineprof_enabled) lineprof_attach(pid, fname);
+    if (aot_enabled) aot_attach(pid, text, count < size ? count : size);
+}
+
+/**
+ * allocate a partition for the program, load it and create its process.
+ * returns 1 on success, 0 if no hole is large enough right now,
+ * -1 if it can never be admitted this way (no PID, internal error)
+ */
+int admit_program(char *fname, int size, int cycle_num)
+{
+    if (text_share_enabled) {
+        /* the text has to be read anyway to find out whether it is loaded already */
+        int count = 0;
+        int (*text)[2] = read_image(fname, &count);
+        if (text) {
+            int rc = admit_image(fname, size, text, count, cycle_num);
+            free(text);
+            return rc;
+        }
+    }
+
+    int pid = -1;
+    int base = reserve_partition(fname, size, cycle_num, &pid);
+    if (base == ADMIT_NO_ROOM) return 0;
+    if (base < 0) return -1;
+
+    /* with demand loading the text is brought in page by page on first touch,
+     * and verified once all of it is in; otherwise check what was loaded */
+    int count = 0;
+    int (*text)[2] = NULL;
+    if (!demand_enabled || !demand_register(pid, fname, size)) text = load_text(fname, base, size, &count);
+    start_process(fname, pid, base, size, text ? verify_program(text, count, size) : 0, text, count);
+    free(text);
+    return 1;
+}
+
+/**
+ * admit a program whose text goes into a shared segment: only the words
+ * after the text get a partition, and the process's base is set `count`
+ * words below it so logical addresses are unchanged
+ */
+static int admit_shared(char *fname, int size, int (*text)[2], int count, int cycle_num)
+{
+    int seg = text_share(text, count, cycle_num);
+    if (seg < 0) return 0;
+
+    int pid = -1;
+    int base = reserve_partition(fname, size - count, cycle_num, &pid);
+    if (base < 0) {
+        text_unshare(seg);
+        return base == ADMIT_NO_ROOM ? 0 : -1;
+    }
+
+    text_bind(pid, seg, base - count);
+    start_process(fname, pid, base - count, size, verify_program(text, count, size), text, count);
+    return 1;
+}
+
+/**
+ * same as admit_program() for a program that has already been translated
+ * (count instructions in text), e.g. by the parallel loader
+ */
+int admit_image(char *fname, int size, int (*text)[2], int count, int cycle_num)
+{
+    if (count > size) count = size; /* never spill into the neighbouring partition */
+    if (text_share_enabled && count > 0 && count < size) return admit_shared(fname, size, text, count, cycle_num);
+
+    int pid = -1;
+    int base = reserve_partition(fname, size, cycle_num, &pid);
+    if (base == ADMIT_NO_ROOM) return 0;
+    if (base < 0) return -1;
+
+    mem_copy_in(base, text, count);
+    loopsum_analyze(base, 0, text, count);
+    start_process(fname, pid, base, size, verify_program(text, count, size), text, count);
+    return 1;
+}
+
+/* PID of the process the last successful admission created, -1 if none */
+int admitted_pid(void)
+{
+    return last_started;
 }
 
 /**
  * required func to define for project 2
  * load multiple programs from a list file
+ * programs that do not fit yet wait in the admission queue
  */
 void load_programs(char list_fname[])
 {
@@ -110,7 +338,6 @@ void load_programs(char list_fname[])
         return;
     }
 
-    char line[512];
     char line[512];
     while (fgets(line, sizeof(line), f)) {
         char *p = trim(line);
@@ -119,26 +346,9 @@ void load_programs(char list_fname[])
         int size = 0;
         char fname[256];
         if (sscanf(p, "%d %255s", &size, fname) == 2) {
-            /* Determine a free PID from the scheduler */
-            int pid = scheduler_get_free_pid();
-            if (pid < 0) {
-                fprintf(stderr, "  -> no free PID available for '%s'\n", fname);
-                continue;
-            }
-
-            int ok = allocate(pid, size);
-            if (!ok) {
-                printf("  -> allocation of %d words for '%s' (PID %d) failed\n", size, fname, pid);
-            } else {
-                int base = get_base_address(pid);
-                if (base < 0) {
-                    fprintf(stderr, "  -> internal error: allocation succeeded but base not found for PID %d\n", pid);
-                } else {
-                    printf("  -> allocated %d words at base %d for '%s' (PID %d)\n", size, base, fname, pid);
-                    load_prog(fname, base);
-                    /* create the process in scheduler using the same PID */
-                    create_process_with_pid(pid, base, size);
-                }
+            if (admit_program(fname, size, 0) == 0) {
+                printf("  -> '%s' queued until %d contiguous words are free\n", fname, size);
+                admission_enqueue(fname, size, 0);
             }
         }
     }
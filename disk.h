@@ -4,10 +4,17 @@
 #ifndef DISK_H
 #define DISK_H
 
-void load_prog(char *fname, int addr);
+void load_prog(char *fname, int addr, int size);
 
 int* translate(char *instruction);
+int translate_into(char *instruction, int out[2]);
 
 void load_programs(char list_fname[]);
 
+int (*read_image(char *fname, int *count))[2];
+
+int admit_program(char *fname, int size, int cycle_num);
+int admit_image(char *fname, int size, int (*text)[2], int count, int cycle_num);
+int admitted_pid(void);
+
 #endif
@@ -0,0 +1,228 @@
+/**
+ * heatmap.c
+ * Optional per-process memory access heatmap and working-set profiler.
+ *
+ * With heatmap_enabled, every guest access (instruction fetch,
+ * load_at_addr, write_at_addr) is counted per process in ranges of
+ * heatmap_range_words logical words. The working set - the words in
+ * ranges touched during the last heatmap_window accesses - is kept
+ * exactly with a ring of the last window's ranges, and sampled at the end
+ * of every window. With heatmap_sample > 1 only about one access in
+ * heatmap_sample is recorded and the counts are scaled back up on export.
+ * Records of exited processes are kept so the whole run can be exported.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heatmap.h"
+#include "scheduler.h"
+#include "table.h"
+
+int heatmap_enabled = 0;     /* set to 1 to profile guest memory accesses */
+int heatmap_range_words = 1; /* words per heatmap cell */
+int heatmap_sample = 1;      /* record 1 in N accesses (1: exact) */
+int heatmap_window = 256;    /* working-set window, in accesses */
+char heatmap_file[] = "heatmap.csv";
+char workingset_file[] = "workingset.csv";
+
+struct heat_proc {
+    int pid;
+    int size;        /* logical words */
+    int nranges;
+    long *reads;     /* per range, recorded accesses */
+    long *writes;
+    long *last;      /* per range: tick of the last access, 0 if never */
+    int *ring;       /* range of each of the last `window` accesses */
+    int window;      /* in recorded accesses */
+    long tick;       /* recorded accesses so far */
+    int live;        /* ranges touched within the window */
+    int peak;
+    int *ws;         /* live ranges at the end of every window */
+    int nws, ws_cap;
+};
+
+static struct heat_proc **procs = NULL; /* running processes, by PID */
+static struct heat_proc **done = NULL;  /* exited processes, in exit order */
+static int procs_cap = 0, done_cap = 0, done_count = 0;
+static unsigned sample_state = 2463534242u;
+
+static void proc_free(struct heat_proc *h)
+{
+    if (!h) return;
+    free(h->reads);
+    free(h->writes);
+    free(h->last);
+    free(h->ring);
+    free(h->ws);
+    free(h);
+}
+
+static struct heat_proc *proc_of(int pid)
+{
+    if (pid < 0) return NULL;
+    if (pid < procs_cap && procs[pid]) return procs[pid];
+
+    PCB *p = scheduler_get_pcb(pid);
+    if (!p || p->size <= 0 || !table_reserve((void **)&procs, &procs_cap, pid, sizeof(*procs))) return NULL;
+
+    struct heat_proc *h = (struct heat_proc *)calloc(1, sizeof(*h));
+    int range = heatmap_range_words > 0 ? heatmap_range_words : 1;
+    int window = heatmap_window / (heatmap_sample > 1 ? heatmap_sample : 1);
+    if (window < 1) window = 1;
+    if (h) {
+        h->pid = pid;
+        h->size = p->size;
+        h->nranges = (p->size + range - 1) / range;
+        h->window = window;
+        h->reads = (long *)calloc(h->nranges, sizeof(long));
+        h->writes = (long *)calloc(h->nranges, sizeof(long));
+        h->last = (long *)calloc(h->nranges, sizeof(long));
+        h->ring = (int *)malloc(window * sizeof(int));
+    }
+    if (!h || !h->reads || !h->writes || !h->last || !h->ring) {
+        fprintf(stderr, "heatmap: out of memory, profiling stopped\n");
+        proc_free(h);
+        heatmap_enabled = 0;
+        return NULL;
+    }
+    procs[pid] = h;
+    return h;
+}
+
+/* count one access to range r at the next tick and slide the window */
+static void record(struct heat_proc *h, int r, int write)
+{
+    long t = ++h->tick;
+    int slot = (int)(t % h->window);
+    if (t > h->window) {
+        /* the access that leaves the window: its range drops out unless touched since */
+        int old = h->ring[slot];
+        if (h->last[old] == t - h->window) h->live--;
+    }
+    if (h->last[r] == 0 || h->last[r] <= t - h->window) h->live++;
+    h->last[r] = t;
+    h->ring[slot] = r;
+    if (write) h->writes[r]++;
+    else h->reads[r]++;
+
+    if (h->live > h->peak) h->peak = h->live;
+    if (slot == 0) {
+        if (table_reserve((void **)&h->ws, &h->ws_cap, h->nws, sizeof(int))) h->ws[h->nws++] = h->live;
+    }
+}
+
+static int sampled(void)
+{
+    if (heatmap_sample <= 1) return 1;
+    /* xorshift32: a fixed stride could line up with a loop and miss it entirely */
+    sample_state ^= sample_state << 13;
+    sample_state ^= sample_state >> 17;
+    sample_state ^= sample_state << 5;
+    return sample_state % (unsigned)heatmap_sample == 0;
+}
+
+/* pid accessed logical address l_addr */
+void heatmap_access(int pid, int l_addr, int write)
+{
+    if (!sampled()) return;
+    struct heat_proc *h = proc_of(pid);
+    if (!h || l_addr < 0 || l_addr >= h->size) return;
+    record(h, l_addr / (heatmap_range_words > 0 ? heatmap_range_words : 1), write);
+}
+
+/* pid fetched the len instructions at l_addr `times` times over without
+ * executing them one by one (a fast-forwarded loop) */
+void heatmap_credit(int pid, int l_addr, int len, long times)
+{
+    for (long k = 0; k < times; ++k) {
+        for (int i = 0; i < len; ++i) heatmap_access(pid, l_addr + i, 0);
+    }
+}
+
+/* pid exited: keep its record for the export */
+void heatmap_release(int pid)
+{
+    if (pid < 0 || pid >= procs_cap || !procs[pid]) return;
+    struct heat_proc *h = procs[pid];
+    procs[pid] = NULL;
+    free(h->ring);
+    h->ring = NULL;
+    if (!table_reserve((void **)&done, &done_cap, done_count, sizeof(*done))) {
+        proc_free(h);
+        return;
+    }
+    done[done_count++] = h;
+}
+
+/* every record, exited processes first; *i is the cursor */
+static struct heat_proc *next_proc(int *i)
+{
+    while (*i < done_count + procs_cap) {
+        int k = (*i)++;
+        struct heat_proc *h = k < done_count ? done[k] : procs[k - done_count];
+        if (h) return h;
+    }
+    return NULL;
+}
+
+/**
+ * write the heatmap (one row per process and range) and the working-set
+ * series (one row per process and window) as CSV. counts are scaled by
+ * heatmap_sample. returns 0 if a file cannot be written
+ */
+int heatmap_export(const char *heat_fname, const char *ws_fname)
+{
+    FILE *hf = fopen(heat_fname, "w");
+    FILE *wf = hf ? fopen(ws_fname, "w") : NULL;
+    if (!hf || !wf) {
+        fprintf(stderr, "heatmap: cannot write %s\n", hf ? ws_fname : heat_fname);
+        if (hf) fclose(hf);
+        return 0;
+    }
+
+    int range = heatmap_range_words > 0 ? heatmap_range_words : 1;
+    long scale = heatmap_sample > 1 ? heatmap_sample : 1;
+    fprintf(hf, "proc,pid,addr,words,reads,writes\n");
+    fprintf(wf, "proc,pid,access,working_set_words\n");
+
+    int i = 0, n = 0;
+    struct heat_proc *h;
+    while ((h = next_proc(&i)) != NULL) {
+        for (int r = 0; r < h->nranges; ++r) {
+            if (h->reads[r] == 0 && h->writes[r] == 0) continue;
+            fprintf(hf, "%d,%d,%d,%d,%ld,%ld\n", n, h->pid, r * range, range,
+                    h->reads[r] * scale, h->writes[r] * scale);
+        }
+        for (int w = 0; w < h->nws; ++w) {
+            fprintf(wf, "%d,%d,%ld,%d\n", n, h->pid, (long)(w + 1) * h->window * scale, h->ws[w] * range);
+        }
+        n++;
+    }
+
+    fclose(hf);
+    fclose(wf);
+    return 1;
+}
+
+void print_heatmap_stats(void)
+{
+    int range = heatmap_range_words > 0 ? heatmap_range_words : 1;
+    long scale = heatmap_sample > 1 ? heatmap_sample : 1;
+    printf("Heatmap: %d-word ranges, 1 in %ld accesses, working-set window %d accesses\n",
+           range, scale, heatmap_window);
+
+    int i = 0;
+    struct heat_proc *h;
+    while ((h = next_proc(&i)) != NULL) {
+        long reads = 0, writes = 0;
+        int touched = 0;
+        for (int r = 0; r < h->nranges; ++r) {
+            reads += h->reads[r];
+            writes += h->writes[r];
+            if (h->last[r]) touched++;
+        }
+        printf("  PID %d (size %d): %ld reads, %ld writes, %d words touched, peak working set %d words\n",
+               h->pid, h->size, reads * scale, writes * scale, touched * range, h->peak * range);
+    }
+}
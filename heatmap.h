@@ -0,0 +1,21 @@
+/**
+ * heatmap.h
+ * Optional per-process memory access heatmap and working-set profiler.
+ */
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+extern int heatmap_enabled;
+extern int heatmap_range_words;
+extern int heatmap_sample;
+extern int heatmap_window;
+extern char heatmap_file[];
+extern char workingset_file[];
+
+void heatmap_access(int pid, int l_addr, int write);
+void heatmap_credit(int pid, int l_addr, int len, long times);
+void heatmap_release(int pid);
+int heatmap_export(const char *heat_fname, const char *ws_fname);
+void print_heatmap_stats(void);
+
+#endif
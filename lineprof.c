@@ -0,0 +1,293 @@
+/**
+ * lineprof.c
+ * Optional source-line PC sampling profiler for guest programs.
+ *
+ * Every program file gets a line table the first time a process running
+ * it is admitted: runs of consecutive instructions on consecutive source
+ * lines, so a program with one comment header costs a single entry. With
+ * lineprof_enabled, one executed instruction in every lineprof_period is
+ * sampled: the PC is counted against the program, and against the
+ * process's call path (a shadow stack kept from call/ret) in a trie of
+ * frames. At exit print_lineprof() prints each program's source annotated
+ * with its samples and lineprof_export() writes the call paths as collapsed
+ * stacks ("prog.txt;fn@L10;L12 42") for flamegraph tools.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lineprof.h"
+#include "disk.h"
+#include "table.h"
+
+#define LINEPROF_BUCKETS 4096
+#define LINEPROF_MAX_DEPTH 64
+
+int lineprof_enabled = 0; /* set to 1 to sample executed PCs */
+int lineprof_period = 1;  /* sample one instruction in N (1: every one) */
+char lineprof_file[] = "lineprof.folded";
+
+struct line_run {
+    int first;   /* first instruction of the run */
+    int line;    /* its source line; the next ones follow line by line */
+};
+
+struct program {
+    char *fname;
+    struct line_run *runs;
+    int nruns, runs_cap;
+    int count;          /* instructions */
+    long *samples;      /* per PC, [count] for PCs outside the text */
+    long total;
+    int processes;
+    int root;           /* trie node of the program itself */
+};
+
+/* a frame of a call path: a function entry, or the sampled PC as the leaf */
+struct frame {
+    int parent;         /* -1 for a program root */
+    int key;            /* entry*2, pc*2+1 for a leaf, program index for a root */
+    long count;         /* samples with this leaf */
+    int next;           /* hash chain */
+};
+
+struct proc_state {
+    int prog;           /* program index + 1, 0 if not profiled */
+    int frame;          /* current function's frame */
+    int depth;          /* calls deep, may exceed the frames kept */
+};
+
+static struct program *progs = NULL;
+static int nprogs = 0, progs_cap = 0;
+static struct frame *frames = NULL;
+static int nframes = 0, frames_cap = 0;
+static int bucket[LINEPROF_BUCKETS];
+static int buckets_ready = 0;
+static struct proc_state *procs = NULL;
+static int procs_cap = 0;
+static long tick = 0;
+
+static int frame_child(int parent, int key)
+{
+    if (!buckets_ready) {
+        for (int b = 0; b < LINEPROF_BUCKETS; ++b) bucket[b] = -1;
+        buckets_ready = 1;
+    }
+    unsigned h = ((unsigned)parent * 2654435761u ^ (unsigned)key) % LINEPROF_BUCKETS;
+    for (int f = bucket[h]; f >= 0; f = frames[f].next) {
+        if (frames[f].parent == parent && frames[f].key == key) return f;
+    }
+    if (!table_reserve((void **)&frames, &frames_cap, nframes, sizeof(*frames))) return -1;
+    struct frame *f = &frames[nframes];
+    f->parent = parent;
+    f->key = key;
+    f->count = 0;
+    f->next = bucket[h];
+    bucket[h] = nframes;
+    return nframes++;
+}
+
+/* build the line table of fname; returns 0 if it cannot be read */
+static int read_lines(struct program *p)
+{
+    FILE *f = fopen(p->fname, "r");
+    if (!f) return 0;
+    char line[512];
+    int lineno = 0, n = 0;
+    while (fgets(line, sizeof(line), f)) {
+        int ins[2];
+        lineno++;
+        if (!translate_into(line, ins)) continue;
+        struct line_run *last = p->nruns ? &p->runs[p->nruns - 1] : NULL;
+        if (!last || last->line + (n - last->first) != lineno) {
+            if (!table_reserve((void **)&p->runs, &p->runs_cap, p->nruns, sizeof(*p->runs))) break;
+            p->runs[p->nruns].first = n;
+            p->runs[p->nruns].line = lineno;
+            p->nruns++;
+        }
+        n++;
+    }
+    fclose(f);
+    p->count = n;
+    return 1;
+}
+
+/* source line of instruction pc, 0 if it is outside the text */
+static int line_of(struct program *p, int pc)
+{
+    if (pc < 0 || pc >= p->count || p->nruns == 0) return 0;
+    int lo = 0, hi = p->nruns - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (p->runs[mid].first <= pc) lo = mid;
+        else hi = mid - 1;
+    }
+    return p->runs[lo].line + (pc - p->runs[lo].first);
+}
+
+static int program_index(char *fname)
+{
+    for (int i = nprogs - 1; i >= 0; --i) {
+        if (strcmp(progs[i].fname, fname) == 0) return i;
+    }
+    if (!table_reserve((void **)&progs, &progs_cap, nprogs, sizeof(*progs))) return -1;
+    struct program *p = &progs[nprogs];
+    memset(p, 0, sizeof(*p));
+    p->fname = strdup(fname);
+    if (!p->fname || !read_lines(p)) {
+        fprintf(stderr, "lineprof: cannot read %s\n", fname);
+        free(p->fname);
+        free(p->runs);
+        return -1;
+    }
+    p->samples = (long *)calloc(p->count + 1, sizeof(long));
+    p->root = frame_child(-1, nprogs);
+    if (!p->samples || p->root < 0) {
+        fprintf(stderr, "lineprof: out of memory\n");
+        free(p->fname);
+        free(p->runs);
+        free(p->samples);
+        return -1;
+    }
+    return nprogs++;
+}
+
+static struct proc_state *state_of(int pid)
+{
+    if (pid < 0 || pid >= procs_cap || procs[pid].prog == 0) return NULL;
+    return &procs[pid];
+}
+
+/* pid runs the program in fname */
+void lineprof_attach(int pid, char *fname)
+{
+    int prog = program_index(fname);
+    if (prog < 0 || !table_reserve((void **)&procs, &procs_cap, pid, sizeof(*procs))) return;
+    procs[pid].prog = prog + 1;
+    procs[pid].frame = progs[prog].root;
+    procs[pid].depth = 0;
+    progs[prog].processes++;
+}
+
+/* a spawned child continues in its parent's call path */
+void lineprof_fork(int parent, int child)
+{
+    struct proc_state *s = state_of(parent);
+    if (!s || !table_reserve((void **)&procs, &procs_cap, child, sizeof(*procs))) return;
+    s = &procs[parent]; /* the table may have moved */
+    procs[child] = *s;
+    progs[s->prog - 1].processes++;
+}
+
+/* pid is about to execute the instruction at pc */
+void lineprof_sample(int pid, int pc)
+{
+    if (++tick < lineprof_period) return;
+    tick = 0;
+    struct proc_state *s = state_of(pid);
+    if (!s) return;
+    struct program *p = &progs[s->prog - 1];
+    int at = (pc >= 0 && pc < p->count) ? pc : p->count;
+    p->samples[at]++;
+    p->total++;
+    int leaf = frame_child(s->frame, at * 2 + 1);
+    if (leaf >= 0) frames[leaf].count++;
+}
+
+/* the len instructions at pc ran `times` times over without being fetched (a fast-forwarded loop) */
+void lineprof_credit(int pid, int pc, int len, long times)
+{
+    for (long k = 0; k < times; ++k) {
+        for (int i = 0; i < len; ++i) lineprof_sample(pid, pc + i);
+    }
+}
+
+void lineprof_call(int pid, int target)
+{
+    struct proc_state *s = state_of(pid);
+    if (!s) return;
+    if (s->depth++ < LINEPROF_MAX_DEPTH) {
+        int f = frame_child(s->frame, target * 2);
+        if (f >= 0) s->frame = f;
+        else s->depth--;
+    }
+}
+
+void lineprof_ret(int pid)
+{
+    struct proc_state *s = state_of(pid);
+    if (!s || s->depth == 0) return;
+    if (s->depth-- <= LINEPROF_MAX_DEPTH) s->frame = frames[s->frame].parent;
+}
+
+void lineprof_release(int pid)
+{
+    if (pid >= 0 && pid < procs_cap) procs[pid].prog = 0;
+}
+
+/* write "frame;frame;leaf" for frame f into out (reversed walk up the trie) */
+static void frame_path(FILE *out, int f)
+{
+    if (frames[f].parent < 0) {
+        fputs(progs[frames[f].key].fname, out);
+        return;
+    }
+    int prog = f;
+    while (frames[prog].parent >= 0) prog = frames[prog].parent;
+    struct program *p = &progs[frames[prog].key];
+
+    frame_path(out, frames[f].parent);
+    int pc = frames[f].key / 2;
+    if (frames[f].key % 2 == 0) fprintf(out, ";fn@L%d", line_of(p, pc));
+    else if (pc < p->count) fprintf(out, ";L%d", line_of(p, pc));
+    else fprintf(out, ";outside text");
+}
+
+/**
+ * write every sampled call path as a collapsed stack, one per line:
+ * "prog.txt;fn@L<entry line>;...;L<line> <count>". returns 0 if the file
+ * cannot be written
+ */
+int lineprof_export(const char *fname)
+{
+    FILE *out = fopen(fname, "w");
+    if (!out) {
+        fprintf(stderr, "lineprof: cannot write %s\n", fname);
+        return 0;
+    }
+    for (int f = 0; f < nframes; ++f) {
+        if (frames[f].count == 0) continue;
+        frame_path(out, f);
+        fprintf(out, " %ld\n", frames[f].count * (lineprof_period > 1 ? lineprof_period : 1));
+    }
+    fclose(out);
+    return 1;
+}
+
+/* every program's source with the samples of each instruction line */
+void print_lineprof(void)
+{
+    for (int i = 0; i < nprogs; ++i) {
+        struct program *p = &progs[i];
+        printf("Line profile: %s (%d processes, %ld samples, 1 in %d instructions)\n",
+               p->fname, p->processes, p->total, lineprof_period);
+        FILE *f = fopen(p->fname, "r");
+        if (!f) continue;
+
+        char line[512];
+        int lineno = 0, pc = 0;
+        while (fgets(line, sizeof(line), f)) {
+            lineno++;
+            line[strcspn(line, "\r\n")] = '\0';
+            if (pc < p->count && line_of(p, pc) == lineno) {
+                long n = p->samples[pc];
+                printf("  %8ld %5.1f%% %4d| %s\n", n, p->total ? 100.0 * n / p->total : 0.0, lineno, line);
+                pc++;
+            } else {
+                printf("  %8s %6s %4d| %s\n", "", "", lineno, line);
+            }
+        }
+        fclose(f);
+        if (p->samples[p->count]) printf("  %8ld samples outside the program text\n", p->samples[p->count]);
+    }
+}
@@ -0,0 +1,22 @@
+/**
+ * lineprof.h
+ * Optional source-line PC sampling profiler for guest programs.
+ */
+#ifndef LINEPROF_H
+#define LINEPROF_H
+
+extern int lineprof_enabled;
+extern int lineprof_period;
+extern char lineprof_file[];
+
+void lineprof_attach(int pid, char *fname);
+void lineprof_fork(int parent, int child);
+void lineprof_sample(int pid, int pc);
+void lineprof_credit(int pid, int pc, int len, long times);
+void lineprof_call(int pid, int target);
+void lineprof_ret(int pid);
+void lineprof_release(int pid);
+int lineprof_export(const char *fname);
+void print_lineprof(void);
+
+#endif
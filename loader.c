@@ -0,0 +1,218 @@
+/**
+ * loader.c
+ * Parallel program loader that feeds the scheduler while the CPU runs.
+ *
+ * loader_start() reads the program list, then loader_threads worker
+ * threads claim programs with an atomic counter, read and translate them
+ * into private images and push the images onto a lock-free
+ * multi-producer/single-consumer queue (mpsc.c).
+ * The simulation thread drains the queue from loader_poll() between
+ * clock cycles and admits images in list order, so PIDs and bases come
+ * out the same as with load_programs(). Everything touching SMM, memory
+ * and the scheduler stays on the simulation thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "loader.h"
+#include "disk.h"
+#include "admit.h"
+#include "mpsc.h"
+
+int loader_threads = 0; /* set > 0 to load in parallel with execution */
+
+struct image {
+    struct mpsc_node node; /* first, so a popped node is the image */
+    int seq;          /* position in the program list */
+    int size;         /* partition size from the list */
+    char *fname;
+    int (*text)[2];   /* translated program, NULL if it could not be read */
+    int count;
+};
+
+/* jobs from the list file */
+static struct image *jobs = NULL;
+static int njobs = 0;
+static atomic_int next_job = 0;
+
+/* built images on their way to the simulation thread */
+static struct mpsc_queue done_queue;
+
+/* reorder buffer: images that arrived ahead of their turn */
+static struct image **arrived = NULL;
+static int next_seq = 0;
+
+static pthread_t *workers = NULL;
+static int nworkers = 0;
+
+static struct timespec t_start;
+static double first_admit_ms = -1.0;
+static double all_admitted_ms = -1.0;
+
+static double ms_since_start(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t_start.tv_sec) * 1000.0 + (now.tv_nsec - t_start.tv_nsec) / 1e6;
+}
+
+/* read and translate one program into a private image */
+static void build_image(struct image *img)
+{
+    FILE *f = fopen(img->fname, "r");
+    if (!f) return;
+
+    char line[512];
+    int cap = 0, ins[2];
+    while (fgets(line, sizeof(line), f)) {
+        if (!translate_into(line, ins)) continue;
+        if (img->count == cap) {
+            cap = cap ? cap * 2 : 64;
+            int (*grown)[2] = realloc(img->text, cap * sizeof(img->text[0]));
+            if (!grown) break;
+            img->text = grown;
+        }
+        img->text[img->count][0] = ins[0];
+        img->text[img->count][1] = ins[1];
+        img->count++;
+    }
+    fclose(f);
+}
+
+static void *worker_main(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        int j = atomic_fetch_add_explicit(&next_job, 1, memory_order_relaxed);
+        if (j >= njobs) break;
+        build_image(&jobs[j]);
+        mpsc_push(&done_queue, &jobs[j].node);
+    }
+    return NULL;
+}
+
+/* trim whitespace from both ends of a string */
+static char *trim(char *s)
+{
+    char *end;
+    while (isspace((unsigned char)*s)) s++;
+    if (*s == 0) return s;
+    end = s + strlen(s) - 1;
+    while (end > s && isspace((unsigned char)*end)) end--;
+    end[1] = '\0';
+    return s;
+}
+
+/**
+ * parse the program list and start the worker threads.
+ * returns 0 if the list cannot be read (nothing is started)
+ */
+int loader_start(char list_fname[])
+{
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    mpsc_init(&done_queue);
+    FILE *f = fopen(list_fname, "r");
+    if (!f) {
+        fprintf(stderr, "Error opening program list %s\n", list_fname);
+        return 0;
+    }
+
+    int cap = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char *p = trim(line);
+        if (*p == '\0' || (p[0] == '/' && p[1] == '/')) continue;
+
+        int size = 0;
+        char fname[256];
+        if (sscanf(p, "%d %255s", &size, fname) != 2) continue;
+        if (njobs == cap) {
+            cap = cap ? cap * 2 : 64;
+            struct image *grown = realloc(jobs, cap * sizeof(struct image));
+            if (!grown) break;
+            jobs = grown;
+        }
+        struct image *img = &jobs[njobs];
+        memset(img, 0, sizeof(*img));
+        img->seq = njobs;
+        img->size = size;
+        img->fname = strdup(fname);
+        if (!img->fname) break;
+        njobs++;
+    }
+    fclose(f);
+
+    arrived = (struct image **)calloc(njobs + 1, sizeof(struct image *));
+    workers = (pthread_t *)calloc(loader_threads > 0 ? loader_threads : 1, sizeof(pthread_t));
+    if (!arrived || !workers) {
+        fprintf(stderr, "loader_start: out of memory\n");
+        njobs = 0;
+        return 0;
+    }
+    for (int i = 0; i < loader_threads; ++i) {
+        if (pthread_create(&workers[nworkers], NULL, worker_main, NULL) == 0) nworkers++;
+    }
+    if (nworkers == 0) worker_main(NULL); /* no threads: load everything here */
+    return 1;
+}
+
+/* 1 while some listed program has not been handed to the scheduler */
+int loader_busy(void)
+{
+    return next_seq < njobs;
+}
+
+/**
+ * admit every finished image whose turn has come. with wait != 0 this
+ * blocks until at least one program is handled (the CPU has nothing
+ * else to do). returns the number of processes admitted
+ */
+int loader_poll(int cycle_num, int wait)
+{
+    int admitted = 0;
+    while (loader_busy()) {
+        struct image *img;
+        while ((img = (struct image *)mpsc_pop(&done_queue)) != NULL) arrived[img->seq] = img;
+
+        int before = next_seq;
+        while (next_seq < njobs && arrived[next_seq]) {
+            img = arrived[next_seq++];
+            if (!img->text) {
+                fprintf(stderr, "Error opening program file %s\n", img->fname);
+            } else {
+                int rc = admit_image(img->fname, img->size, img->text, img->count, cycle_num);
+                if (rc == 0) {
+                    printf("  -> '%s' queued until %d contiguous words are free\n", img->fname, img->size);
+                    admission_enqueue(img->fname, img->size, cycle_num);
+                } else if (rc > 0) {
+                    admitted++;
+                    if (first_admit_ms < 0) first_admit_ms = ms_since_start();
+                }
+            }
+            free(img->text);
+            img->text = NULL;
+        }
+
+        if (!wait || next_seq > before) break;
+        sched_yield();
+    }
+
+    if (!loader_busy() && all_admitted_ms < 0) {
+        for (int i = 0; i < nworkers; ++i) pthread_join(workers[i], NULL);
+        nworkers = 0;
+        all_admitted_ms = ms_since_start();
+    }
+    return admitted;
+}
+
+void print_loader_stats(void)
+{
+    printf("Loader: %d programs, %d threads, first admission after %.3f ms, all handled after %.3f ms\n",
+           njobs, loader_threads, first_admit_ms, all_admitted_ms);
+}
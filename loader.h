@@ -0,0 +1,15 @@
+/**
+ * loader.h
+ * Parallel program loader that feeds the scheduler while the CPU runs.
+ */
+#ifndef LOADER_H
+#define LOADER_H
+
+extern int loader_threads;
+
+int loader_start(char list_fname[]);
+int loader_busy(void);
+int loader_poll(int cycle_num, int wait);
+void print_loader_stats(void);
+
+#endif
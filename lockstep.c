@@ -0,0 +1,495 @@
+/**
+ * lockstep.c
+ * Lockstep (SIMD) execution of ready processes that run identical text.
+ *
+ * Ready processes whose PC points at the same instruction are grouped and
+ * executed together: one fetch/decode per step, with the AC/MAR/MBR of every
+ * process held in lanes and updated with vector ops (AVX2 or SSE2 when the
+ * compiler targets them, plain C otherwise). A lane leaves the group as soon
+ * as it would behave differently from the rest (different text, a split
+ * ifgo) and is handed back to the normal scheduler; lanes that fault are
+ * terminated exactly like mem_read()/mem_write() would. No process is
+ * current while lanes run, so accesses are checked here and then copied
+ * directly. When every lane has a plain partition (no shared text or COW
+ * pages), one range check against the smallest partition covers the
+ * whole group and the words are gathered or scattered in one call;
+ * otherwise each lane goes through mem_translate() on its own.
+ *
+ * Groups are formed again at the start of every quantum; attempts that
+ * find nothing to group back off, up to LOCKSTEP_MAX_BACKOFF quanta. Each
+ * lane runs at most the quantum it would get on the CPU, so a group holds
+ * the CPU no longer than a round-robin pass over its processes. With the
+ * timing model a step costs what timing_block_cost() gives loopsum's
+ * bodies: the opcode cost plus cache hits.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "lockstep.h"
+#include "cpu.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "smm.h"
+#include "demand.h"
+#include "cow.h"
+#include "text.h"
+#include "heatmap.h"
+#include "lineprof.h"
+#include "aot.h"
+#include "timing.h"
+
+int lockstep_enabled = 0;      /* set to 1 to run homogeneous batches in lanes */
+int lockstep_max_steps = 100000; /* per group and quantum, then lanes go back to the scheduler */
+
+#define LOCKSTEP_MAX_BACKOFF 64
+
+#if defined(__AVX2__)
+#define LANE_WIDTH 8
+#elif defined(__SSE2__)
+#define LANE_WIDTH 4
+#else
+#define LANE_WIDTH 1
+#endif
+
+typedef struct lane_group {
+    int count;
+    int pc;
+    int ir0, ir1;
+    int limit;       /* logical words every lane may access; 0: check each lane */
+    PCB **pcb;
+    int *base;       /* physical address of each lane's logical 0 */
+    int *ac;
+    int *mar;
+    int *mbr;
+    int *addr;       /* physical addresses of the current access */
+    int (*word)[2];  /* words gathered from them */
+} lane_group;
+
+typedef struct lane_key {
+    int pc;
+    int op;
+    int arg;
+    PCB *pcb;
+} lane_key;
+
+#if LANE_WIDTH > 1
+typedef int lane_vec __attribute__((vector_size(LANE_WIDTH * sizeof(int))));
+
+#define LANES_BINOP(name, expr)                                 \
+static void name(int *a, const int *b, int n)                   \
+{                                                               \
+    int i = 0;                                                  \
+    for (; i + LANE_WIDTH <= n; i += LANE_WIDTH) {              \
+        lane_vec x, y;                                          \
+        memcpy(&x, a + i, sizeof(x));                           \
+        memcpy(&y, b + i, sizeof(y));                           \
+        x = (expr);                                             \
+        memcpy(a + i, &x, sizeof(x));                           \
+    }                                                           \
+    for (; i < n; ++i) {                                        \
+        int x = a[i], y = b[i];                                 \
+        a[i] = (expr);                                          \
+    }                                                           \
+}
+#else
+#define LANES_BINOP(name, expr)                                 \
+static void name(int *a, const int *b, int n)                   \
+{                                                               \
+    for (int i = 0; i < n; ++i) {                               \
+        int x = a[i], y = b[i];                                 \
+        a[i] = (expr);                                          \
+    }                                                           \
+}
+#endif
+
+LANES_BINOP(lanes_add, x + y)
+LANES_BINOP(lanes_mul, x * y)
+LANES_BINOP(lanes_and, ((x != 0) & (y != 0)) & 1)
+LANES_BINOP(lanes_or, ((x != 0) | (y != 0)) & 1)
+
+static void lanes_fill(int *a, int v, int n)
+{
+    for (int i = 0; i < n; ++i) a[i] = v;
+}
+
+/* move lane `from` into slot `to` */
+static void lane_move(lane_group *g, int to, int from)
+{
+    g->pcb[to] = g->pcb[from];
+    g->base[to] = g->base[from];
+    g->ac[to] = g->ac[from];
+    g->mar[to] = g->mar[from];
+    g->mbr[to] = g->mbr[from];
+}
+
+/* drop lane i from the group without saving it */
+static void lane_drop(lane_group *g, int i)
+{
+    g->count--;
+    if (i != g->count) lane_move(g, i, g->count);
+}
+
+/* save lane i back into its PCB at `pc` and return it to the scheduler */
+static void lane_leave(lane_group *g, int i, int pc)
+{
+    PCB *p = g->pcb[i];
+    p->pc = (uint32_t)pc;
+    p->registers[0] = (uint32_t)g->ac[i];
+    p->registers[1] = (uint32_t)g->mar[i];
+    p->registers[2] = (uint32_t)g->mbr[i];
+    p->registers[3] = (uint32_t)g->ir0;
+    p->registers[4] = (uint32_t)g->ir1;
+    lane_drop(g, i);
+}
+
+/* same treatment as mem_read()/mem_write() give an illegal access */
+static void lane_fault(lane_group *g, int i, const char *what, int addr)
+{
+    int pid = g->pcb[i]->pid;
+    fprintf(stderr, "%s ERROR: PID %d illegal memory access at address %d - terminating process\n", what, pid, addr);
+    cow_release(pid);
+    deallocate(pid);
+    remove_process_from_ready(pid);
+    lane_drop(g, i);
+}
+
+/**
+ * if logical address off[i] + imm (off may be NULL) lies in the partition
+ * of every lane, put the physical addresses in g->addr and return 1;
+ * 0 if the lanes have to be checked one by one
+ */
+static int lanes_flat(lane_group *g, const int *off, int imm)
+{
+    if (g->limit == 0) return 0;
+    int lo = 0, hi = 0;
+    if (off) {
+        lo = hi = off[0];
+        for (int i = 1; i < g->count; ++i) {
+            if (off[i] < lo) lo = off[i];
+            if (off[i] > hi) hi = off[i];
+        }
+    }
+    if ((long long)lo + imm < 0 || (long long)hi + imm >= g->limit) return 0;
+    for (int i = 0; i < g->count; ++i) g->addr[i] = g->base[i] + (off ? off[i] : 0) + imm;
+    return 1;
+}
+
+/* per-lane bookkeeping for an access lanes_flat() let through */
+static void lanes_note(lane_group *g, const int *off, int imm, int write)
+{
+    if (!demand_pending && !heatmap_enabled && !(write && aot_active)) return;
+    for (int i = 0; i < g->count; ++i) {
+        PCB *p = g->pcb[i];
+        int l = (off ? off[i] : 0) + imm;
+        if (demand_pending) demand_touch(p->pid, p->base, l);
+        if (heatmap_enabled) heatmap_access(p->pid, l, write);
+        if (write && aot_active) aot_text_write(p->pid, l);
+    }
+}
+
+/* dst[i] = word at logical address off[i] + imm of lane i (off may be NULL) */
+static void lanes_load(lane_group *g, int *dst, const int *off, int imm)
+{
+    if (lanes_flat(g, off, imm)) {
+        lanes_note(g, off, imm, 0);
+        mem_gather(g->addr, g->word, g->count);
+        for (int i = 0; i < g->count; ++i) dst[i] = g->word[i][0];
+        return;
+    }
+    for (int i = 0; i < g->count; ) {
+        PCB *p = g->pcb[i];
+        int l = (off ? off[i] : 0) + imm;
+        int addr = p->base + l;
+        if (demand_pending) demand_touch(p->pid, p->base, l);
+        int phys = mem_translate(p->pid, addr, 0);
+        if (phys < 0) {
+            lane_fault(g, i, "mem_read", addr);
+            continue;
+        }
+        if (heatmap_enabled) heatmap_access(p->pid, l, 0);
+        int word[2];
+        mem_copy_out(phys, &word, 1);
+        dst[i] = word[0];
+        i++;
+    }
+}
+
+/* word at logical address off[i] + imm of lane i = src[i] */
+static void lanes_store(lane_group *g, const int *src, const int *off, int imm)
+{
+    if (lanes_flat(g, off, imm)) {
+        lanes_note(g, off, imm, 1);
+        mem_scatter(g->addr, src, g->count);
+        return;
+    }
+    for (int i = 0; i < g->count; ) {
+        PCB *p = g->pcb[i];
+        int l = (off ? off[i] : 0) + imm;
+        int addr = p->base + l;
+        if (demand_pending) demand_touch(p->pid, p->base, l);
+        int phys = mem_translate(p->pid, addr, 1);
+        if (phys < 0) {
+            lane_fault(g, i, "mem_write", addr);
+            continue;
+        }
+        if (heatmap_enabled) heatmap_access(p->pid, l, 1);
+        if (aot_active) aot_text_write(p->pid, l);
+        int data[2] = {src[i], 0};
+        mem_copy_in(phys, &data, 1);
+        i++;
+    }
+}
+
+/* fetch the instruction at g->pc for every lane; lanes whose text differs leave */
+static int lanes_fetch(lane_group *g, int *op, int *arg)
+{
+    if (g->count > 0 && lanes_flat(g, NULL, g->pc)) {
+        lanes_note(g, NULL, g->pc, 0);
+        mem_gather(g->addr, g->word, g->count);
+        *op = g->word[0][0];
+        *arg = g->word[0][1];
+        /* from the top, so the lane moved into a leaving one's slot was compared already */
+        for (int i = g->count - 1; i > 0; --i) {
+            if (g->word[i][0] != *op || g->word[i][1] != *arg) lane_leave(g, i, g->pc);
+        }
+        return 1;
+    }
+    int have = 0;
+    for (int i = 0; i < g->count; ) {
+        PCB *p = g->pcb[i];
+        int addr = p->base + g->pc;
+        int phys = mem_translate(p->pid, addr, 0);
+        if (phys < 0) {
+            lane_fault(g, i, "mem_read", addr);
+            continue;
+        }
+        if (demand_pending) demand_touch(p->pid, p->base, g->pc);
+        if (heatmap_enabled) heatmap_access(p->pid, g->pc, 0);
+        int slot[2];
+        mem_copy_out(phys, &slot, 1);
+        if (!have) {
+            *op = slot[0];
+            *arg = slot[1];
+            have = 1;
+        } else if (slot[0] != *op || slot[1] != *arg) {
+            lane_leave(g, i, g->pc);
+            continue;
+        }
+        i++;
+    }
+    return have;
+}
+
+/* cycles each lane is charged for one instruction: 1, or with the timing
+ * model its cost with the fetch and any data access hitting the cache */
+static int lanes_cost(lane_group *g, int op, int arg)
+{
+    if (!timing_enabled) return 1;
+    int ins[1][2] = {{op, arg}};
+    int data = op == 6 || op == 7 || (op >= 17 && op <= 20);
+    for (int i = 0; i < g->count; ++i) timing_credit_hits(g->pcb[i]->pid, 1 + data);
+    return timing_block_cost(ins, 1) + data * cache_hit_cycles;
+}
+
+/* run one group until every lane exits, faults or diverges, max_steps pass
+ * or every lane has used `quantum` cycles */
+static int run_group(lane_group *g, int max_steps, int quantum)
+{
+    int cycles = 0;
+    int spent = 0; /* cycles of each lane still in the group */
+    for (int step = 0; step < max_steps && spent < quantum && g->count > 0; ++step) {
+        int op = 0, arg = 0;
+        if (!lanes_fetch(g, &op, &arg)) break;
+        int cost = lanes_cost(g, op, arg);
+        spent += cost;
+        cycles += cost * g->count;
+        cpu_instructions += g->count;
+        if (lineprof_enabled) {
+            for (int i = 0; i < g->count; ++i) lineprof_sample(g->pcb[i]->pid, g->pc);
+        }
+        g->ir0 = op;
+        g->ir1 = arg;
+
+        switch (op) {
+            case 0: /* exit */
+                while (g->count > 0) {
+                    int pid = g->pcb[0]->pid;
+                    lane_leave(g, 0, g->pc);
+                    scheduler_finish_process(pid);
+                }
+                break;
+
+            case 1: lanes_fill(g->ac, arg, g->count); g->pc++; break;
+            case 2: memcpy(g->ac, g->mbr, g->count * sizeof(int)); g->pc++; break;
+            case 3: memcpy(g->ac, g->mar, g->count * sizeof(int)); g->pc++; break;
+            case 4: memcpy(g->mbr, g->ac, g->count * sizeof(int)); g->pc++; break;
+            case 5: memcpy(g->mar, g->ac, g->count * sizeof(int)); g->pc++; break;
+
+            case 6: lanes_load(g, g->mbr, g->mar, 0); g->pc++; break;  /* load_at_addr */
+            case 7: lanes_store(g, g->mbr, g->mar, 0); g->pc++; break; /* write_at_addr */
+
+            case 8: lanes_add(g->ac, g->mbr, g->count); g->pc++; break;
+            case 9: lanes_mul(g->ac, g->mbr, g->count); g->pc++; break;
+            case 10: lanes_and(g->ac, g->mbr, g->count); g->pc++; break;
+            case 11: lanes_or(g->ac, g->mbr, g->count); g->pc++; break;
+
+            case 16: /* dbnz: decrement, then branch like ifgo */
+                for (int i = 0; i < g->count; ++i) g->ac[i]--;
+                /* fall through */
+            case 12: /* ifgo: the majority direction stays, the rest diverge */
+            {
+                int taken = 0;
+                for (int i = 0; i < g->count; ++i) taken += (g->ac[i] != 0);
+                int stay_taken = taken * 2 >= g->count;
+                int other_pc = stay_taken ? g->pc + 1 : arg;
+                for (int i = 0; i < g->count; ) {
+                    if ((g->ac[i] != 0) != stay_taken) {
+                        lane_leave(g, i, other_pc);
+                        continue;
+                    }
+                    i++;
+                }
+                g->pc = stay_taken ? arg : g->pc + 1;
+                break;
+            }
+
+            case 13: g->pc++; break;
+
+            case 15: for (int i = 0; i < g->count; ++i) g->ac[i] += arg; g->pc++; break;
+            case 17: lanes_load(g, g->ac, NULL, arg); g->pc++; break;   /* load_from */
+            case 18: lanes_store(g, g->ac, NULL, arg); g->pc++; break;  /* store_to */
+            case 19: lanes_load(g, g->ac, g->mar, arg); g->pc++; break;  /* load_idx */
+            case 20: lanes_store(g, g->ac, g->mar, arg); g->pc++; break; /* store_idx */
+
+            case 14: /* spawn needs the scheduler and lanes keep no SP: every lane goes back */
+            case 21: case 22: case 23: case 24:
+                while (g->count > 0) lane_leave(g, 0, g->pc);
+                break;
+
+            default:
+                for (int i = 0; i < g->count; ++i) fprintf(stderr, "Error: invalid opcode %d\n", op);
+                g->pc++;
+                break;
+        }
+    }
+
+    while (g->count > 0) lane_leave(g, 0, g->pc);
+    return cycles;
+}
+
+static int key_cmp(const void *a, const void *b)
+{
+    const lane_key *x = a, *y = b;
+    if (x->pc != y->pc) return x->pc < y->pc ? -1 : 1;
+    if (x->op != y->op) return x->op < y->op ? -1 : 1;
+    if (x->arg != y->arg) return x->arg < y->arg ? -1 : 1;
+    return 0;
+}
+
+/**
+ * group the ready processes by the instruction their PC points at and run
+ * every group of two or more in lockstep, each lane for at most what is
+ * left of the current quantum. Processes left over (singletons, diverged
+ * lanes, lanes out of steps) stay in the ready queue.
+ * returns the number of process cycles executed
+ */
+int lockstep_run(int cycle_num)
+{
+    int quantum = scheduler_quantum_left(cycle_num + (timing_enabled ? timing_pending_cycles() : 0));
+    scheduler_park_current();
+
+    int n = scheduler_ready_pcbs(NULL, 0);
+    PCB **ready = (PCB **)malloc((n + 1) * sizeof(PCB *));
+    lane_key *keys = (lane_key *)malloc((n + 1) * sizeof(lane_key));
+    lane_group g;
+    g.pcb = (PCB **)malloc((n + 1) * sizeof(PCB *));
+    g.base = (int *)malloc((n + 1) * sizeof(int));
+    g.ac = (int *)malloc((n + 1) * sizeof(int));
+    g.mar = (int *)malloc((n + 1) * sizeof(int));
+    g.mbr = (int *)malloc((n + 1) * sizeof(int));
+    g.addr = (int *)malloc((n + 1) * sizeof(int));
+    g.word = (int (*)[2])malloc((n + 1) * sizeof(g.word[0]));
+    if (!ready || !keys || !g.pcb || !g.base || !g.ac || !g.mar || !g.mbr || !g.addr || !g.word) {
+        fprintf(stderr, "lockstep_run: out of memory\n");
+        free(ready); free(keys); free(g.pcb); free(g.base); free(g.ac); free(g.mar); free(g.mbr);
+        free(g.addr); free(g.word);
+        scheduler_resume(cycle_num);
+        return 0;
+    }
+    scheduler_ready_pcbs(ready, n);
+
+    int k = 0;
+    for (int i = 0; i < n; ++i) {
+        if (ready[i]->flags & PCB_SWAPPED) continue; /* base is stale until swapped in */
+        int addr = mem_translate(ready[i]->pid, ready[i]->base + (int)ready[i]->pc, 0);
+        if (addr < 0) continue; /* let the scheduler fault it */
+        if (demand_pending) demand_touch(ready[i]->pid, ready[i]->base, (int)ready[i]->pc);
+        int slot[2];
+        mem_copy_out(addr, &slot, 1);
+        keys[k].pc = (int)ready[i]->pc;
+        keys[k].op = slot[0];
+        keys[k].arg = slot[1];
+        keys[k].pcb = ready[i];
+        k++;
+    }
+    qsort(keys, k, sizeof(lane_key), key_cmp);
+
+    int total = 0;
+    for (int i = 0; i < k; ) {
+        int j = i + 1;
+        while (j < k && key_cmp(&keys[i], &keys[j]) == 0) j++;
+        if (j - i >= 2) {
+            g.count = j - i;
+            g.pc = keys[i].pc;
+            /* plain partitions only: shared text and COW pages are not at base + l */
+            g.limit = text_active || cow_active ? 0 : INT_MAX;
+            for (int l = 0; l < g.count; ++l) {
+                PCB *p = keys[i + l].pcb;
+                g.pcb[l] = p;
+                g.base[l] = p->base;
+                g.ac[l] = (int)p->registers[0];
+                g.mar[l] = (int)p->registers[1];
+                g.mbr[l] = (int)p->registers[2];
+                if (get_base_address(p->pid) != p->base) g.limit = 0;
+                else if (p->size < g.limit) g.limit = p->size;
+            }
+            total += run_group(&g, lockstep_max_steps, quantum);
+        }
+        i = j;
+    }
+
+    free(ready); free(keys); free(g.pcb); free(g.base); free(g.ac); free(g.mar); free(g.mbr);
+    free(g.addr); free(g.word);
+    scheduler_resume(cycle_num + total);
+    return total;
+}
+
+/**
+ * lockstep_run() if the scheduler switched processes since the last call,
+ * i.e. once per quantum. after an attempt that runs nothing, the next
+ * 1, 2, 4 ... LOCKSTEP_MAX_BACKOFF quanta are skipped.
+ * returns the process cycles executed
+ */
+int lockstep_poll(int cycle_num)
+{
+    static long seen = -1;
+    static int backoff = 0, skip = 0;
+
+    long switches = scheduler_switch_count();
+    if (switches == seen) return 0;
+    seen = switches;
+    if (scheduler_ready_count() < 2) return 0;
+    if (skip > 0) {
+        skip--;
+        return 0;
+    }
+
+    int ran = lockstep_run(cycle_num);
+    seen = scheduler_switch_count(); /* its own resume is not a new quantum */
+    if (ran > 0) backoff = 0;
+    else backoff = backoff == 0 ? 1 : backoff * 2 > LOCKSTEP_MAX_BACKOFF ? LOCKSTEP_MAX_BACKOFF : backoff * 2;
+    skip = backoff;
+    return ran;
+}
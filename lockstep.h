@@ -0,0 +1,14 @@
+/**
+ * lockstep.h
+ * Lockstep (SIMD) execution of ready processes that run identical text.
+ */
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+extern int lockstep_enabled;
+extern int lockstep_max_steps;
+
+int lockstep_run(int cycle_num);
+int lockstep_poll(int cycle_num);
+
+#endif
@@ -0,0 +1,153 @@
+/**
+ * loopsum.c
+ * Counted-loop summaries.
+ *
+ * At load time every backward `ifgo T` or `dbnz T` whose body [T, branch)
+ * only does `add`, `add_imm` (and `sleep`) is recorded: such a loop adds
+ * adds*MBR + imm to AC per iteration (dbnz counting as add_imm -1), touches
+ * no memory and exits once AC hits 0, so the number of iterations can be
+ * computed instead of executed. At run time
+ * loopsum_fast_forward() jumps straight to the exit state, or as many whole
+ * iterations as fit in the time quantum. Summaries of a partition are
+ * dropped when the SMM gives it back.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loopsum.h"
+#include "cpu.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "timing.h"
+#include "heatmap.h"
+#include "lineprof.h"
+#include "smm.h"
+
+#ifndef MEM_SIZE
+#define MEM_SIZE 1024
+#endif
+
+int loopsum_enabled = 1; /* set to 0 to execute loops cycle by cycle */
+
+struct loop_summary {
+    int head;     /* logical address of the first body instruction (T) */
+    int branch;   /* logical address of the ifgo/dbnz */
+    int adds;     /* number of `add` in the body */
+    int imm;      /* sum of the add_imm arguments, -1 for a dbnz */
+    int body[][2]; /* body + branch as loaded, checked before every jump */
+};
+
+/* loop_at[phys] -> summary whose head is loaded at phys, or NULL */
+static struct loop_summary *loop_at[MEM_SIZE];
+static int hooked = 0;
+
+/* forget the loops loaded in [base, base + size) */
+void loopsum_forget(int base, int size)
+{
+    if (base < 0) base = 0;
+    for (int a = base; a < base + size && a < MEM_SIZE; ++a) {
+        free(loop_at[a]);
+        loop_at[a] = NULL;
+    }
+}
+
+/**
+ * record every summarizable loop in `prog`, the `count` instructions
+ * starting at logical address `first` of a program loaded at base.
+ * loops reaching outside the slice are ignored
+ */
+void loopsum_analyze(int base, int first, int (*prog)[2], int count)
+{
+    if (!hooked) {
+        smm_set_release_hook(loopsum_forget);
+        hooked = 1;
+    }
+    for (int j = 0; j < count; ++j) {
+        if (prog[j][0] != 12 && prog[j][0] != 16) continue;
+        int t = prog[j][1] - first; /* branch target within the slice */
+        if (t < 0 || t >= j) continue;
+
+        int adds = 0, imm = prog[j][0] == 16 ? -1 : 0, ok = 1;
+        for (int i = t; i < j && ok; ++i) {
+            if (prog[i][0] == 8) adds++;
+            else if (prog[i][0] == 15) imm += prog[i][1];
+            else if (prog[i][0] != 13) ok = 0;
+        }
+        if (!ok || (adds == 0 && imm == 0)) continue;
+
+        int phys = base + first + t;
+        if (phys < 0 || phys >= MEM_SIZE) continue;
+
+        int len = j - t + 1;
+        struct loop_summary *s = (struct loop_summary *)malloc(sizeof(*s) + len * sizeof(s->body[0]));
+        if (!s) {
+            fprintf(stderr, "loopsum_analyze: out of memory\n");
+            return;
+        }
+        s->head = first + t;
+        s->branch = first + j;
+        s->adds = adds;
+        s->imm = imm;
+        memcpy(s->body, prog + t, len * sizeof(s->body[0]));
+
+        free(loop_at[phys]);
+        loop_at[phys] = s;
+    }
+}
+
+/**
+ * if PC is at the head of a summarized loop, run whole iterations of it
+ * (at most max_cycles worth) in one step: AC, PC, IR0 and IR1 end up exactly
+ * as if the loop had been executed. returns the cycles charged, 0 if nothing
+ * was skipped and the caller should run clock_cycle() as usual
+ */
+int loopsum_fast_forward(int max_cycles)
+{
+    int pid = get_current_pid();
+    if (pid < 0) return 0;
+    int addr = mem_address(PC);
+    int phys = mem_translate(pid, addr, 0); /* shared text is analyzed where it is loaded */
+    if (phys < 0 || phys >= MEM_SIZE || loop_at[phys] == NULL) return 0;
+    struct loop_summary *s = loop_at[phys];
+
+    /* the body may have been overwritten since the load; read it without
+     * mem_read(), whose permission check would terminate the process */
+    int len = s->branch - s->head + 1;
+    for (int i = 0; i < len; ++i) {
+        int p = i == 0 ? phys : mem_translate(pid, addr + i, 0);
+        int word[2];
+        if (p < 0 || !mem_copy_out(p, &word, 1)) return 0;
+        if (word[0] != s->body[i][0] || word[1] != s->body[i][1]) return 0;
+    }
+
+    int cost = timing_enabled ? timing_block_cost(s->body, len) : len; /* body + branch */
+    long long step = (long long)s->adds * MBR + s->imm;
+    long long need = -(long long)AC;
+    long long n;
+    if (step == 0) {
+        if (AC != 0) return 0; /* never exits */
+        n = 1;
+    } else {
+        if (need % step != 0 || need / step < 1) return 0; /* exits only after overflow */
+        n = need / step;
+    }
+
+    long long k = max_cycles / cost;
+    if (k <= 0) return 0;
+    if (k > n) k = n;
+    cpu_instructions += k * len;
+    if (timing_enabled) timing_credit_hits(get_current_pid(), k * len);
+    if (heatmap_enabled) heatmap_credit(pid, s->head, len, k);
+    if (lineprof_enabled) lineprof_credit(pid, s->head, len, k);
+    IR0 = s->body[len - 1][0];
+    IR1 = s->head;
+    if (k == n) {
+        AC = 0;
+        PC = s->branch + 1;
+        return (int)(n * cost);
+    }
+    AC = (int)((long long)AC + k * step);
+    PC = s->head;
+    return (int)(k * cost);
+}
@@ -0,0 +1,14 @@
+/**
+ * loopsum.h
+ * Counted-loop summaries: fast-forward countdown loops in closed form.
+ */
+#ifndef LOOPSUM_H
+#define LOOPSUM_H
+
+extern int loopsum_enabled;
+
+void loopsum_analyze(int base, int first, int (*prog)[2], int count);
+void loopsum_forget(int base, int size);
+int loopsum_fast_forward(int max_cycles);
+
+#endif
@@ -10,11 +10,97 @@
 #include "memory.h"
 #include "scheduler.h"
 #include "smm.h"
+#include "lockstep.h"
+#include "loopsum.h"
+#include "swap.h"
+#include "admit.h"
+#include "timing.h"
+#include "loader.h"
+#include "cow.h"
+#include "text.h"
+#include "heatmap.h"
+#include "lineprof.h"
+#include "server.h"
+#include "client.h"
+#include "verify.h"
+#include "sweep.h"
+#include "aot.h"
+#include "monitor.h"
 #include <ctype.h>
+#include <string.h>
 
-int main(void)
+/* run one clock cycle (or a fast-forwarded loop); returns 0 once nothing is left to run */
+static int run_cycle(int *cycles)
+{
+    if (swap_enabled) *cycles += swap_take_stall_cycles(); /* waited for the last swap-in */
+    if (get_current_pid() < 0) return schedule(*cycles, CPU_SWITCH); /* nothing may run on a dead process's registers */
+    if (lockstep_enabled) {
+        /* a new quantum: run groups of identical processes in SIMD lanes first */
+        *cycles += lockstep_poll(*cycles);
+        if (swap_enabled) *cycles += swap_take_stall_cycles();
+        if (get_current_pid() < 0) return schedule(*cycles, CPU_SWITCH);
+    }
+    if (smm_telemetry_enabled) smm_sample(*cycles);
+    if (monitor_enabled) monitor_update(*cycles);
+    if (loopsum_enabled) {
+        /* skip whole loop iterations, never past the end of the quantum */
+        int now = *cycles + (timing_enabled ? timing_pending_cycles() : 0);
+        int skipped = loopsum_fast_forward(scheduler_quantum_left(now));
+        if (skipped > 0) {
+            *cycles += skipped;
+            schedule(*cycles, 1);
+            return 1;
+        }
+    }
+    if (aot_enabled) {
+        /* run compiled code up to the end of the quantum */
+        int status = 1;
+        int ran = aot_run(scheduler_quantum_left(*cycles), &status);
+        if (ran > 0) {
+            *cycles += ran;
+            int alive = schedule(*cycles, status);
+            if (admission_poll(*cycles) > 0) alive = 1;
+            return alive;
+        }
+    }
+    int cont = clock_cycle();
+    *cycles += timing_enabled ? timing_take_cycles() : 1;
+    int alive = schedule(*cycles, cont);
+    if (admission_poll(*cycles) > 0) alive = 1; /* memory freed up for a queued program */
+    return alive;
+}
+
+static void print_stats(int cycles)
+{
+    if (monitor_enabled) monitor_stop(cycles);
+    /* Print SMM statistic: how many new holes were created */
+    print_new_hole_count();
+    if (smm_cache_words > 0) print_smm_cache_stats();
+    if (smm_telemetry_enabled) {
+        print_smm_telemetry();
+        if (smm_export_telemetry(smm_telemetry_file)) printf("SMM telemetry written to %s\n", smm_telemetry_file);
+    }
+    if (swap_enabled) print_swap_stats();
+    print_admission_stats();
+    if (loader_threads > 0) print_loader_stats();
+    print_cow_stats();
+    if (verify_enabled) print_verify_stats();
+    if (aot_enabled) print_aot_stats();
+    if (text_share_enabled) print_text_stats();
+    if (heatmap_enabled) {
+        print_heatmap_stats();
+        if (heatmap_export(heatmap_file, workingset_file)) printf("Heatmap written to %s, working sets to %s\n", heatmap_file, workingset_file);
+    }
+    if (lineprof_enabled) {
+        print_lineprof();
+        if (lineprof_export(lineprof_file)) printf("Collapsed stacks written to %s\n", lineprof_file);
+    }
+    if (timing_enabled) print_timing_stats(cycles);
+}
+
+/* load the program list and create a process for every entry */
+static void load_workload(char *progfile)
 {
-    char progfile[] = "program_list.txt"; //hard coded program file name, change as needed
     Base = 4;
     PC = 0;
 
@@ -23,7 +109,12 @@ int main(void)
      FILE *list;
      char line[512];
 
-     load_programs(progfile);
+     if (loader_threads > 0) {
+         /* programs are admitted by loader_poll() while the CPU runs */
+         loader_start(progfile);
+     } else {
+         load_programs(progfile);
+     }
 
      list = fopen(progfile, "r");
     if (list) {
@@ -53,16 +144,61 @@ int main(void)
         }
         fclose(list);
     }
+}
 
+/* run the loaded processes to completion; returns the cycles taken */
+static int simulate(void)
+{
     printf("Starting CPU execution...\n");
     int cycles = 0;
-    while (1) {
-        int cont = clock_cycle();
-        cycles++;
-        int alive = schedule(cycles, cont);
-        if (!alive) break;
+    while (!ready_queue_empty() || loader_busy()) {
+        if (loader_busy()) {
+            /* admit programs the loader has finished; block only if nothing can run */
+            loader_poll(cycles, ready_queue_empty());
+            if (ready_queue_empty()) continue;
+        }
+        if (!run_cycle(&cycles) && !loader_busy()) break;
+    }
+    return cycles;
+}
+
+/* daemon mode: run jobs from the socket until a client asks for shutdown */
+static int serve(const char *path)
+{
+    if (!server_start(path)) return 1;
+    int cycles = 0;
+    while (server_running()) {
+        server_poll(cycles, ready_queue_empty());
+        if (ready_queue_empty()) continue;
+        run_cycle(&cycles);
+    }
+    server_stop();
+    printf("Server stopped after %d cycles.\n", cycles);
+    print_server_stats();
+    print_stats(cycles);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) return serve(argc > 2 ? argv[2] : server_socket);
+    if (argc > 2 && strcmp(argv[1], "--submit") == 0) return client_submit(argv[2], argc - 3, argv + 3);
+    if (argc > 1 && strcmp(argv[1], "--top") == 0) return monitor_view(argc > 2 ? argv[2] : monitor_name);
+
+    char progfile[] = "program_list.txt"; //hard coded program file name, change as needed
+    FILE *list;
+    char line[512];
+
+    if (argc > 1 && strcmp(argv[1], "--sweep") == 0) {
+        /* load once, then run every configuration in a forked copy */
+        loader_threads = 0;
+        load_workload(argc > 2 ? argv[2] : progfile);
+        return sweep_run(argc > 3 ? argv[3] : sweep_quanta, simulate) ? 0 : 1;
     }
 
+    load_workload(progfile);
+    int cycles = simulate();
+
     printf("Program exited.\n\n");
 
     /* Print the requested absolute memory locations */
@@ -75,8 +211,7 @@ int main(void)
         else printf(" mem[%d] = (out of bounds)\n", a);
     }
 
-    /* Print SMM statistic: how many new holes were created */
-    print_new_hole_count();
+    print_stats(cycles);
 
     list = fopen("program_list.txt", "r");
     if (list) {
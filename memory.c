@@ -4,11 +4,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "smm.h"
 #include "scheduler.h"
 #include "memory.h"
+#include "cow.h"
+#include "text.h"
 
+#ifndef MEM_SIZE
 #define MEM_SIZE 1024
+#endif
 
 static int physical_memory[MEM_SIZE][2];
 
@@ -19,21 +24,22 @@ static int physical_memory[MEM_SIZE][2];
  */
 int* mem_read(int addr)
 {
-    if (addr < 0 || addr >= MEM_SIZE) {
-        fprintf(stderr, "mem_read ERROR: address %d out of bounds (0..%d)\n", addr, MEM_SIZE - 1);
-        return NULL;
-    }
     /* If a process is running, check permission with SMM */
     int pid = get_current_pid();
-    if (pid >= 0) {
-        if (!is_allowed_address(pid, addr)) {
-            fprintf(stderr, "mem_read ERROR: PID %d illegal memory access at address %d - terminating process\n", pid, addr);
-            deallocate(pid);
-            remove_process_from_ready(pid);
+    int phys = pid >= 0 ? mem_translate(pid, addr, 0) : addr;
+    if (addr < 0 || addr >= MEM_SIZE) {
+        if (phys < 0 || phys >= MEM_SIZE) {
+            fprintf(stderr, "mem_read ERROR: address %d out of bounds (0..%d)\n", addr, MEM_SIZE - 1);
             return NULL;
         }
+    } else if (phys < 0) {
+        fprintf(stderr, "mem_read ERROR: PID %d illegal memory access at address %d - terminating process\n", pid, addr);
+        cow_release(pid);
+        deallocate(pid);
+        remove_process_from_ready(pid);
+        return NULL;
     }
-    return physical_memory[addr];
+    return physical_memory[phys];
 }
 
 /*
@@ -45,21 +51,67 @@ int* mem_read(int addr)
 void mem_write(int addr, int* data)
 {
     if (data == NULL) return;
-    if (addr < 0 || addr >= MEM_SIZE) return;
-
     /* If a process is running, check permission with SMM */
     int pid = get_current_pid();
-    if (pid >= 0) {
-        if (!is_allowed_address(pid, addr)) {
-            fprintf(stderr, "mem_write ERROR: PID %d illegal memory access at address %d - terminating process\n", pid, addr);
-            deallocate(pid);
-            remove_process_from_ready(pid);
-            return;
-        }
+    int phys = pid >= 0 ? mem_translate(pid, addr, 1) : addr;
+    if (addr < 0 || addr >= MEM_SIZE) {
+        if (phys < 0 || phys >= MEM_SIZE) return;
+    } else if (phys < 0) {
+        fprintf(stderr, "mem_write ERROR: PID %d illegal memory access at address %d - terminating process\n", pid, addr);
+        cow_release(pid);
+        deallocate(pid);
+        remove_process_from_ready(pid);
+        return;
     }
 
-    physical_memory[addr][0] = data[0]; //opcode
-    physical_memory[addr][1] = data[1]; //argument
+    physical_memory[phys][0] = data[0]; //opcode
+    physical_memory[phys][1] = data[1]; //argument
+}
+
+/**
+ * mem_read() for a running process the load-time verifier proved
+ * (verify.c): addr is known to lie in its partition, so the permission
+ * check is skipped and only its shared text is mapped. verified
+ * processes are never COW children
+ */
+int* mem_read_verified(int addr)
+{
+    if (text_active) {
+        int t = text_translate(get_current_pid(), addr, 0);
+        if (t >= 0) return physical_memory[t];
+    }
+    return physical_memory[addr];
+}
+
+/* mem_write() for a verified process; it never writes to its text */
+void mem_write_verified(int addr, int* data)
+{
+    /* children sharing this page keep the old contents */
+    if (cow_active) cow_owner_write(get_current_pid(), addr);
+    physical_memory[addr][0] = data[0];
+    physical_memory[addr][1] = data[1];
+}
+
+/**
+ * physical address for an access by pid to addr: through its shared text
+ * segment or a spawned child's page map where those cover addr, otherwise
+ * addr itself if it lies in pid's partition. a write may copy pages for
+ * COW children first. returns -1 if the access is illegal
+ */
+int mem_translate(int pid, int addr, int write)
+{
+    if (text_active) {
+        int t = text_translate(pid, addr, write);
+        if (t != -1) return t < 0 ? -1 : t; /* -2: text is read-only */
+    }
+    if (cow_active) {
+        int c = cow_translate(pid, addr, write);
+        if (c >= 0) return c;
+    }
+    if (!is_allowed_address(pid, addr)) return -1;
+    /* children sharing this page keep the old contents */
+    if (write && cow_active) cow_owner_write(pid, addr);
+    return addr;
 }
 
 /**
@@ -74,3 +126,43 @@ void mem_print(int addr)
     }
     printf("mem[%d] = { OP=%d, ARG=%d }\n", addr, p[0], p[1]);
 }
+
+/*
+ * copy `count` words starting at addr out of / into physical memory
+ * used by the swapper, so no permission check against the running process
+ * returns 0 if the range is out of bounds
+ */
+int mem_copy_out(int addr, int (*dst)[2], int count)
+{
+    if (addr < 0 || count < 0 || addr + count > MEM_SIZE) return 0;
+    memcpy(dst, physical_memory[addr], count * sizeof(physical_memory[0]));
+    return 1;
+}
+
+int mem_copy_in(int addr, int (*src)[2], int count)
+{
+    if (addr < 0 || count < 0 || addr + count > MEM_SIZE) return 0;
+    memcpy(physical_memory[addr], src, count * sizeof(physical_memory[0]));
+    return 1;
+}
+
+/*
+ * dst[i] = word at addr[i], and word at addr[i] = {value[i], 0} like a
+ * data write, for n addresses at once. used by lockstep lanes, which
+ * have checked every address already, so no permission check here
+ */
+void mem_gather(const int *addr, int (*dst)[2], int n)
+{
+    for (int i = 0; i < n; ++i) {
+        dst[i][0] = physical_memory[addr[i]][0];
+        dst[i][1] = physical_memory[addr[i]][1];
+    }
+}
+
+void mem_scatter(const int *addr, const int *value, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        physical_memory[addr[i]][0] = value[i];
+        physical_memory[addr[i]][1] = 0;
+    }
+}
@@ -5,6 +5,13 @@
 int* mem_read(int addr);
 void mem_write(int addr, int* data);
 void mem_print(int addr);
+int* mem_read_verified(int addr);
+void mem_write_verified(int addr, int* data);
+int mem_translate(int pid, int addr, int write);
+int mem_copy_out(int addr, int (*dst)[2], int count);
+int mem_copy_in(int addr, int (*src)[2], int count);
+void mem_gather(const int *addr, int (*dst)[2], int n);
+void mem_scatter(const int *addr, const int *value, int n);
 
 #endif
 
@@ -0,0 +1,240 @@
+/**
+ * monitor.c
+ * Live statistics published in POSIX shared memory, and a viewer for them.
+ *
+ * With monitor_enabled, the simulator creates the shared memory object
+ * monitor_name holding one struct monitor_stats and refreshes it every
+ * monitor_period cycles: current cycle, running PID, ready-queue length,
+ * instructions executed and per second, free memory, largest hole and
+ * swap stalls. Between updates the only cost on the simulation path is
+ * one comparison; an update reads counters the scheduler, CPU and SMM
+ * keep anyway and does a few relaxed atomic stores framed by a sequence
+ * counter, with no locks or I/O. monitor_view() (./program2 --top)
+ * attaches read-only from another process and redraws a top-style screen
+ * from consistent snapshots until the simulator finishes.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "monitor.h"
+#include "cpu.h"
+#include "scheduler.h"
+#include "smm.h"
+#include "swap.h"
+
+int monitor_enabled = 0;            /* set to 1 to publish live statistics */
+int monitor_period = 1000;          /* cycles between updates */
+char monitor_name[] = "/program2.stats";
+
+#define MONITOR_REFRESH_MS 1000     /* viewer redraw interval */
+
+static struct monitor_stats *stats = NULL;
+static int next_update = 0;
+static long long last_instructions = 0, last_ns = 0;
+
+static long long now_ns(clockid_t clock)
+{
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/* create the segment; on failure monitoring is switched off */
+static int monitor_start(void)
+{
+    int fd = shm_open(monitor_name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(struct monitor_stats)) < 0) {
+        fprintf(stderr, "monitor: cannot create %s: %s\n", monitor_name, strerror(errno));
+        if (fd >= 0) close(fd);
+        monitor_enabled = 0;
+        return 0;
+    }
+    void *p = mmap(NULL, sizeof(struct monitor_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "monitor: cannot map %s: %s\n", monitor_name, strerror(errno));
+        shm_unlink(monitor_name);
+        monitor_enabled = 0;
+        return 0;
+    }
+    stats = (struct monitor_stats *)p;
+    memset(stats, 0, sizeof(*stats)); /* a previous run may have left it behind */
+    stats->version = MONITOR_VERSION;
+    stats->size = sizeof(*stats);
+    stats->writer = (int32_t)getpid();
+    last_ns = now_ns(CLOCK_MONOTONIC);
+    atomic_store_explicit(&stats->magic, MONITOR_MAGIC, memory_order_release);
+    return 1;
+}
+
+static void publish(int cycle_num, int state)
+{
+    int free_total = 0, largest = 0, holes = 0;
+    smm_free_space(&free_total, &largest, &holes);
+    long long ns = now_ns(CLOCK_MONOTONIC);
+    long long done = cpu_instructions;
+    long long rate = ns > last_ns ? (done - last_instructions) * 1000000000LL / (ns - last_ns) : 0;
+    last_instructions = done;
+    last_ns = ns;
+
+    uint64_t seq = atomic_load_explicit(&stats->seq, memory_order_relaxed);
+    atomic_store_explicit(&stats->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&stats->state, state, memory_order_relaxed);
+    atomic_store_explicit(&stats->running_pid, get_current_pid(), memory_order_relaxed);
+    atomic_store_explicit(&stats->cycle, cycle_num, memory_order_relaxed);
+    atomic_store_explicit(&stats->instructions, done, memory_order_relaxed);
+    atomic_store_explicit(&stats->instructions_per_sec, rate, memory_order_relaxed);
+    atomic_store_explicit(&stats->ready, scheduler_ready_count(), memory_order_relaxed);
+    atomic_store_explicit(&stats->free_words, free_total, memory_order_relaxed);
+    atomic_store_explicit(&stats->largest_hole, largest, memory_order_relaxed);
+    atomic_store_explicit(&stats->holes, holes, memory_order_relaxed);
+    atomic_store_explicit(&stats->swap_stalls, swap_stall_cycles(), memory_order_relaxed);
+    atomic_store_explicit(&stats->updated_ns, now_ns(CLOCK_REALTIME), memory_order_relaxed);
+    atomic_store_explicit(&stats->seq, seq + 2, memory_order_release);
+}
+
+/* publish the statistics if cycle_num reached the next update point */
+void monitor_update(int cycle_num)
+{
+    if (cycle_num < next_update) return;
+    next_update = cycle_num - cycle_num % monitor_period + monitor_period;
+    if (!stats && !monitor_start()) return;
+    publish(cycle_num, MONITOR_RUNNING);
+}
+
+/* final update; viewers already attached see the run finish, then the name goes away */
+void monitor_stop(int cycle_num)
+{
+    if (!stats) return;
+    publish(cycle_num, MONITOR_FINISHED);
+    munmap(stats, sizeof(*stats));
+    stats = NULL;
+    shm_unlink(monitor_name);
+}
+
+struct snapshot {
+    int state, running_pid, ready, free_words, largest_hole, holes;
+    long long cycle, instructions, instructions_per_sec, swap_stalls, updated_ns;
+};
+
+/* a copy of m taken between two updates; 0 if the writer kept interfering */
+static int take_snapshot(struct monitor_stats *m, struct snapshot *s)
+{
+    for (int tries = 0; tries < 1000; ++tries) {
+        uint64_t before = atomic_load_explicit(&m->seq, memory_order_acquire);
+        if (before & 1) continue;
+        s->state = atomic_load_explicit(&m->state, memory_order_relaxed);
+        s->running_pid = atomic_load_explicit(&m->running_pid, memory_order_relaxed);
+        s->cycle = atomic_load_explicit(&m->cycle, memory_order_relaxed);
+        s->instructions = atomic_load_explicit(&m->instructions, memory_order_relaxed);
+        s->instructions_per_sec = atomic_load_explicit(&m->instructions_per_sec, memory_order_relaxed);
+        s->ready = atomic_load_explicit(&m->ready, memory_order_relaxed);
+        s->free_words = atomic_load_explicit(&m->free_words, memory_order_relaxed);
+        s->largest_hole = atomic_load_explicit(&m->largest_hole, memory_order_relaxed);
+        s->holes = atomic_load_explicit(&m->holes, memory_order_relaxed);
+        s->swap_stalls = atomic_load_explicit(&m->swap_stalls, memory_order_relaxed);
+        s->updated_ns = atomic_load_explicit(&m->updated_ns, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&m->seq, memory_order_relaxed) == before) return 1;
+    }
+    return 0;
+}
+
+static void sleep_ms(int ms)
+{
+    struct timespec t = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&t, NULL);
+}
+
+/* map the segment read-only, waiting for it to appear; NULL if it is not ours */
+static struct monitor_stats *attach(const char *name)
+{
+    int waiting = 0;
+    for (;;) {
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd >= 0) {
+            struct stat st;
+            void *p = MAP_FAILED;
+            if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(struct monitor_stats)) {
+                p = mmap(NULL, sizeof(struct monitor_stats), PROT_READ, MAP_SHARED, fd, 0);
+            }
+            close(fd);
+            if (p != MAP_FAILED) {
+                struct monitor_stats *m = (struct monitor_stats *)p;
+                if (atomic_load_explicit(&m->magic, memory_order_acquire) == MONITOR_MAGIC) {
+                    if (m->version == MONITOR_VERSION) return m;
+                    fprintf(stderr, "monitor: %s has layout version %u, this viewer reads %d\n",
+                            name, m->version, MONITOR_VERSION);
+                    munmap(p, sizeof(struct monitor_stats));
+                    return NULL;
+                }
+                munmap(p, sizeof(struct monitor_stats)); /* still being set up */
+            }
+        } else if (errno != ENOENT) {
+            fprintf(stderr, "monitor: cannot open %s: %s\n", name, strerror(errno));
+            return NULL;
+        }
+        if (!waiting) {
+            printf("Waiting for a simulator to publish %s ...\n", name);
+            fflush(stdout);
+            waiting = 1;
+        }
+        sleep_ms(MONITOR_REFRESH_MS);
+    }
+}
+
+/**
+ * top-style viewer: redraw the statistics in name every second until the
+ * simulator finishes or goes away. returns the process exit status
+ */
+int monitor_view(const char *name)
+{
+    struct monitor_stats *m = attach(name);
+    if (!m) return 1;
+
+    struct snapshot s, prev;
+    int have_prev = 0, idle = 0;
+    for (;;) {
+        if (!take_snapshot(m, &s)) {
+            sleep_ms(MONITOR_REFRESH_MS);
+            continue;
+        }
+        int gone = s.state != MONITOR_FINISHED && kill(m->writer, 0) < 0 && errno == ESRCH;
+        if (have_prev && s.cycle == prev.cycle && s.state == MONITOR_RUNNING) idle++;
+        else idle = 0;
+        long long stall_rate = have_prev ? s.swap_stalls - prev.swap_stalls : 0;
+        double age = (now_ns(CLOCK_REALTIME) - s.updated_ns) / 1e9;
+
+        printf("\033[H\033[2J");
+        printf("program2 %s  simulator PID %d  layout v%u\n\n", name, m->writer, m->version);
+        if (gone) printf("state        simulator exited without finishing\n");
+        else if (s.state == MONITOR_FINISHED) printf("state        finished\n");
+        else if (idle > 0) printf("state        no progress for %d s\n", idle * MONITOR_REFRESH_MS / 1000);
+        else printf("state        running\n");
+        printf("cycle        %lld\n", s.cycle);
+        printf("instructions %lld\n", s.instructions);
+        printf("speed        %.3f M instructions/s\n", s.instructions_per_sec / 1e6);
+        if (s.running_pid >= 0) printf("running PID  %d\n", s.running_pid);
+        else printf("running PID  -\n");
+        printf("ready queue  %d\n", s.ready);
+        printf("free memory  %d words in %d holes, largest %d\n", s.free_words, s.holes, s.largest_hole);
+        printf("swap stalls  %lld cycles (+%lld since last refresh)\n", s.swap_stalls, stall_rate);
+        printf("updated      %.1f s ago\n", age);
+        fflush(stdout);
+
+        if (gone || s.state == MONITOR_FINISHED) break;
+        prev = s;
+        have_prev = 1;
+        sleep_ms(MONITOR_REFRESH_MS);
+    }
+    munmap(m, sizeof(*m));
+    return 0;
+}
@@ -0,0 +1,48 @@
+/**
+ * monitor.h
+ * Live statistics published in POSIX shared memory, and a viewer for them.
+ */
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define MONITOR_MAGIC 0x50324d53u /* "P2MS" */
+#define MONITOR_VERSION 2         /* bump when the layout below changes */
+
+enum { MONITOR_STARTING, MONITOR_RUNNING, MONITOR_FINISHED };
+
+/**
+ * the shared block. magic is stored last when the block is created; the
+ * other fields are written with relaxed stores between two increments of
+ * seq, which is odd while an update is in progress
+ */
+struct monitor_stats {
+    _Atomic uint32_t magic;
+    uint32_t version;
+    uint32_t size;                 /* sizeof(struct monitor_stats) of the writer */
+    int32_t writer;                /* host PID of the simulator */
+    _Atomic uint64_t seq;
+    _Atomic int32_t state;
+    _Atomic int32_t running_pid;   /* -1 if none */
+    _Atomic int64_t cycle;
+    _Atomic int64_t instructions;  /* executed so far, loopsum, AOT and lockstep included */
+    _Atomic int64_t instructions_per_sec; /* over the last period */
+    _Atomic int32_t ready;         /* processes in the ready queue */
+    _Atomic int32_t free_words;    /* in holes, not counting the SMM thread caches */
+    _Atomic int32_t largest_hole;
+    _Atomic int32_t holes;
+    _Atomic int64_t swap_stalls;   /* cycles spent waiting for swap-ins */
+    _Atomic int64_t updated_ns;    /* CLOCK_REALTIME of the last update */
+};
+
+extern int monitor_enabled;
+extern int monitor_period;
+extern char monitor_name[];
+
+void monitor_update(int cycle_num);
+void monitor_stop(int cycle_num);
+int monitor_view(const char *name);
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * mpsc.c
+ * Lock-free multi-producer/single-consumer queue (Vyukov's intrusive MPSC queue).
+ *
+ * Any number of threads may push; a push is one atomic exchange and
+ * never waits. Only one thread may pop. A pop can briefly see the queue
+ * as empty while a push is half done; the node shows up on a later pop.
+ */
+#include <stddef.h>
+
+#include "mpsc.h"
+
+void mpsc_init(struct mpsc_queue *q)
+{
+    atomic_store_explicit(&q->stub.next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&q->head, &q->stub, memory_order_relaxed);
+    q->tail = &q->stub;
+}
+
+void mpsc_push(struct mpsc_queue *q, struct mpsc_node *n)
+{
+    atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
+    struct mpsc_node *prev = atomic_exchange_explicit(&q->head, n, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, n, memory_order_release);
+}
+
+/* returns NULL when empty or when a push is half done */
+struct mpsc_node *mpsc_pop(struct mpsc_queue *q)
+{
+    struct mpsc_node *tail = q->tail;
+    struct mpsc_node *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &q->stub) {
+        if (!next) return NULL;
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire)) return NULL;
+    mpsc_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
@@ -0,0 +1,25 @@
+/**
+ * mpsc.h
+ * Lock-free multi-producer/single-consumer queue (Vyukov's intrusive MPSC queue).
+ */
+#ifndef MPSC_H
+#define MPSC_H
+
+#include <stdatomic.h>
+
+/* embed as the first member of the queued struct */
+struct mpsc_node {
+    struct mpsc_node *_Atomic next;
+};
+
+struct mpsc_queue {
+    struct mpsc_node *_Atomic head; /* producers swap this */
+    struct mpsc_node *tail;         /* owned by the consumer */
+    struct mpsc_node stub;
+};
+
+void mpsc_init(struct mpsc_queue *q);
+void mpsc_push(struct mpsc_queue *q, struct mpsc_node *n);
+struct mpsc_node *mpsc_pop(struct mpsc_queue *q);
+
+#endif
@@ -6,25 +6,106 @@
 #include <string.h>
 #include "scheduler.h"
 #include "cpu.h"
+#include "swap.h"
+#include "smm.h"
+#include "demand.h"
+#include "timing.h"
+#include "table.h"
+#include "cow.h"
+#include "text.h"
+#include "heatmap.h"
+#include "lineprof.h"
+#include "aot.h"
 
 int time_quantum = 10;
 
-static PCB process_table[MAX_PROCESSES];
-static int occupied[MAX_PROCESSES] = {0};
+/* Tables indexed by PID; they grow with the highest PID handed out */
+static PCB **process_table = NULL;     /* PCBs, allocated on first use and kept for reuse */
+static ReadyNode **ready_node = NULL;  /* node of each PID in the ready queue, NULL if none */
+static char *occupied = NULL;
+static int pcb_cap = 0, node_cap = 0, occupied_cap = 0;
+
+/* Released PIDs (min-heap, so the lowest free PID is reused first) and
+ * the first PID never handed out */
+static int *free_pids = NULL;
+static int free_count = 0, free_cap = 0;
+static int pid_limit = 0;
 
 static ReadyNode *ready_head = NULL;
 static ReadyNode *ready_tail = NULL;
+static int ready_count = 0;
 
 static PCB *current = NULL;
 
+static void (*exit_hook)(PCB *p, int faulted, int cycle_num) = NULL;
+
 static int last_cycle_checkpoint = 0;
+static int sched_cycle = 0; /* cycle of the last schedule() call */
+static int switch_stall = 0; /* swap-in wait of the process just switched to */
+static long switches = 0;    /* context switches so far */
 
-//find the first free pid in the process table
+static int pid_occupied(int pid) {
+    return pid < occupied_cap && occupied[pid];
+}
+
+static void free_pid_push(int pid) {
+    if (!table_reserve((void **)&free_pids, &free_cap, free_count, sizeof(int))) return;
+    int i = free_count++;
+    while (i > 0 && free_pids[(i - 1) / 2] > pid) {
+        free_pids[i] = free_pids[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    free_pids[i] = pid;
+}
+
+static void free_pid_pop(void) {
+    int last = free_pids[--free_count];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= free_count) break;
+        if (c + 1 < free_count && free_pids[c + 1] < free_pids[c]) c++;
+        if (free_pids[c] >= last) break;
+        free_pids[i] = free_pids[c];
+        i = c;
+    }
+    if (free_count > 0) free_pids[i] = last;
+}
+
+//find the lowest free pid: a released one, else the next never used
 static int find_free_pid(void) {
-    for (int i = 0; i < MAX_PROCESSES; ++i) {
-        if (!occupied[i]) return i;
+    /* entries may be stale if a PID was taken directly by create_process_with_pid */
+    while (free_count > 0 && pid_occupied(free_pids[0])) free_pid_pop();
+    if (free_count > 0) return free_pids[0];
+    return pid_limit;
+}
+
+/* mark pid used and return its PCB, growing the tables as needed */
+static PCB *claim_pid(int pid) {
+    if (!table_reserve((void **)&occupied, &occupied_cap, pid, sizeof(char)) ||
+        !table_reserve((void **)&process_table, &pcb_cap, pid, sizeof(PCB *)) ||
+        !table_reserve((void **)&ready_node, &node_cap, pid, sizeof(ReadyNode *))) {
+        return NULL;
+    }
+    if (!process_table[pid]) {
+        process_table[pid] = (PCB *)malloc(sizeof(PCB));
+        if (!process_table[pid]) {
+            fprintf(stderr, "claim_pid: out of memory\n");
+            return NULL;
+        }
     }
-    return -1;
+    /* PIDs skipped over become free */
+    while (pid_limit < pid) free_pid_push(pid_limit++);
+    if (pid_limit == pid) pid_limit++;
+    occupied[pid] = 1;
+    return process_table[pid];
+}
+
+/* mark pid free again */
+static void release_pid(int pid) {
+    if (!pid_occupied(pid)) return;
+    occupied[pid] = 0;
+    free_pid_push(pid);
 }
 
 /* Public wrapper to get a free PID (does not mark it occupied). */
@@ -41,12 +122,15 @@ static void enqueue_ready(PCB *pcb) {
     }
     n->pcb = pcb;
     n->next = NULL;
+    n->prev = ready_tail;
     if (ready_tail == NULL) {
         ready_head = ready_tail = n;
     } else {
         ready_tail->next = n;
         ready_tail = n;
     }
+    ready_node[pcb->pid] = n;
+    ready_count++;
 }
 
 //remove and return the head node of the ready queue
@@ -55,6 +139,8 @@ static ReadyNode *dequeue_ready_node(void) {
     ReadyNode *n = ready_head;
     ready_head = ready_head->next;
     if (ready_head == NULL) ready_tail = NULL;
+    else ready_head->prev = NULL;
+    ready_count--;
     n->next = NULL;
     return n;
 }
@@ -66,20 +152,19 @@ static ReadyNode *dequeue_ready_node(void) {
  */
 void new_process(int base, int size) {
     int pid = find_free_pid();
-    if (pid < 0) {
+    PCB *p = claim_pid(pid);
+    if (!p) {
         fprintf(stderr, "new_process: process table full\n");
         return;
     }
 
-    PCB *p = &process_table[pid];
-    occupied[pid] = 1;
-
     p->pid = pid;
     p->base = base;
     p->size = size;
     p->pc = 0;
-    p->sp = 0;
+    p->sp = (uint32_t)size; /* empty stack at the end of the partition */
     p->flags = 0;
+    p->arrival = sched_cycle;
     memset(p->registers, 0, sizeof(p->registers));
 
     enqueue_ready(p);
@@ -94,24 +179,28 @@ void new_process(int base, int size) {
  * initializes the PCB, then enqueues it on the ready queue.
  */
 void create_process_with_pid(int pid, int base, int size) {
-    if (pid < 0 || pid >= MAX_PROCESSES) {
+    if (pid < 0) {
         fprintf(stderr, "create_process_with_pid: invalid pid %d\n", pid);
         return;
     }
-    if (occupied[pid]) {
+    if (pid_occupied(pid)) {
         fprintf(stderr, "create_process_with_pid: pid %d already occupied\n", pid);
         return;
     }
 
-    PCB *p = &process_table[pid];
-    occupied[pid] = 1;
+    PCB *p = claim_pid(pid);
+    if (!p) {
+        fprintf(stderr, "create_process_with_pid: process table full\n");
+        return;
+    }
 
     p->pid = pid;
     p->base = base;
     p->size = size;
     p->pc = 0;
-    p->sp = 0;
+    p->sp = (uint32_t)size; /* empty stack at the end of the partition */
     p->flags = 0;
+    p->arrival = sched_cycle;
     memset(p->registers, 0, sizeof(p->registers));
 
     enqueue_ready(p);
@@ -133,21 +222,39 @@ void next_process(void) {
     if (first) {
         if (ready_tail == NULL) {
             ready_head = ready_tail = first;
+            first->prev = NULL;
         } else {
             ready_tail->next = first;
+            first->prev = ready_tail;
             ready_tail = first;
             ready_tail->next = NULL;
         }
+        ready_count++;
     }
 }
 
 void scheduler_context_switch(void) {
+    switch_stall = 0;
     if (!ready_head) {
         current = NULL;
         return;
     }
 
     PCB *new_pcb = ready_head->pcb;
+    PCB *prev_pcb = current;
+
+    if (swap_enabled) {
+        /* park first so the outgoing process may be evicted to make room */
+        scheduler_park_current();
+        switch_stall = swap_in(new_pcb, sched_cycle);
+        if (switch_stall < 0) {
+            fprintf(stderr, "scheduler: PID %d cannot be swapped back in - terminating process\n", new_pcb->pid);
+            remove_process_from_ready(new_pcb->pid);
+            scheduler_context_switch();
+            return;
+        }
+    }
+
     PCB *old_pcb = current;
 
     register_struct new_vals;
@@ -158,6 +265,7 @@ void scheduler_context_switch(void) {
     new_vals.MBR = (int)new_pcb->registers[2];
     new_vals.IR0 = (int)new_pcb->registers[3];
     new_vals.IR1 = (int)new_pcb->registers[4];
+    new_vals.SP = (int)new_pcb->sp;
 
     register_struct old_vals = context_switch(new_vals);
 
@@ -169,16 +277,50 @@ void scheduler_context_switch(void) {
         old_pcb->registers[2] = (uint32_t)old_vals.MBR;
         old_pcb->registers[3] = (uint32_t)old_vals.IR0;
         old_pcb->registers[4] = (uint32_t)old_vals.IR1;
+        old_pcb->sp = (uint32_t)old_vals.SP;
     }
 
     current = new_pcb;
+    switches++;
+    cpu_set_verified((new_pcb->flags & PCB_VERIFIED) != 0);
+    if (timing_enabled && prev_pcb && prev_pcb != new_pcb) timing_context_switch();
+
+    if (swap_enabled && ready_head->next) {
+        /* the process right behind the new one runs next: start its swap-in now */
+        swap_prefetch(ready_head->next->pcb, sched_cycle);
+    }
+}
+
+/* copy the registers of the running process into its PCB for the exit hook */
+static void save_running(PCB *p) {
+    p->base = Base;
+    p->pc = (uint32_t)PC;
+    p->registers[0] = (uint32_t)AC;
+    p->registers[1] = (uint32_t)MAR;
+    p->registers[2] = (uint32_t)MBR;
+    p->registers[3] = (uint32_t)IR0;
+    p->registers[4] = (uint32_t)IR1;
+    p->sp = (uint32_t)SP;
 }
 
 static void remove_head_process(void) {
     ReadyNode *n = dequeue_ready_node();
     if (!n) return;
     PCB *p = n->pcb;
-    occupied[p->pid] = 0;
+    if (exit_hook) {
+        if (p == current) save_running(p);
+        exit_hook(p, 0, sched_cycle);
+    }
+    ready_node[p->pid] = NULL;
+    release_pid(p->pid);
+    swap_release(p->pid);
+    demand_release(p->pid);
+    cow_release(p->pid); /* before the partition its children may share goes away */
+    text_release(p->pid);
+    heatmap_release(p->pid);
+    lineprof_release(p->pid);
+    aot_release(p->pid);
+    if (get_base_address(p->pid) >= 0) deallocate(p->pid); /* give the partition back */
     free(n);
 }
 
@@ -186,30 +328,58 @@ int ready_queue_empty(void) {
     return ready_head == NULL;
 }
 
+/* Call hook(p, faulted, cycle) for every process leaving the system, with
+ * its final registers in p: faulted is 0 after an exit instruction, 1 if
+ * it was terminated. Pass NULL to remove the hook.
+ */
+void scheduler_set_exit_hook(void (*hook)(PCB *p, int faulted, int cycle_num)) {
+    exit_hook = hook;
+}
+
 /* Remove a process with the given PID from the ready queue.
  * If the process is found, remove its ReadyNode, mark its table slot free,
  * free the node, and return. If not found, do nothing.
  */
-void remove_process_from_ready(int pid) {
-    ReadyNode *prev = NULL;
-    ReadyNode *cur = ready_head;
-    while (cur) {
-        if (cur->pcb && cur->pcb->pid == pid) {
-            /* unlink node */
-            if (prev) prev->next = cur->next;
-            else ready_head = cur->next;
-            if (cur == ready_tail) {
-                ready_tail = prev;
-            }
-
-            /* mark process table entry free and free node */
-            occupied[pid] = 0;
-            free(cur);
-            return;
-        }
-        prev = cur;
-        cur = cur->next;
+static void remove_ready(int pid, int faulted) {
+    if (pid < 0 || pid >= node_cap || !ready_node[pid]) return;
+    ReadyNode *cur = ready_node[pid];
+    if (exit_hook) {
+        if (current == cur->pcb) save_running(cur->pcb);
+        exit_hook(cur->pcb, faulted, sched_cycle);
     }
+    if (current && current->pid == pid) current = NULL;
+
+    /* unlink node */
+    if (cur->prev) cur->prev->next = cur->next;
+    else ready_head = cur->next;
+    if (cur->next) cur->next->prev = cur->prev;
+    else ready_tail = cur->prev;
+    ready_count--;
+
+    /* mark process table entry free and free node */
+    ready_node[pid] = NULL;
+    release_pid(pid);
+    swap_release(pid);
+    demand_release(pid);
+    cow_release(pid);
+    text_release(pid);
+    heatmap_release(pid);
+    lineprof_release(pid);
+    aot_release(pid);
+    free(cur);
+}
+
+void remove_process_from_ready(int pid) {
+    remove_ready(pid, 1);
+}
+
+/* Same as remove_process_from_ready() for a process that ran its exit
+ * instruction outside the CPU (lockstep lanes); its partition is given
+ * back here, as remove_head_process() does after an exit on the CPU.
+ */
+void scheduler_finish_process(int pid) {
+    remove_ready(pid, 0);
+    if (get_base_address(pid) >= 0) deallocate(pid);
 }
 
 /* Return PID of currently running process, or -1 if none. */
@@ -222,23 +392,26 @@ int get_current_pid(void) {
  * required func to define for project 2
  * recieves as input the number of clock cycles
  * calls next_process followed by context switch if time quantum expires
- * also recieves as input the process_status returned by the clock_cycle
+ * also recieves as input the process_status returned by the clock_cycle;
+ * 0 (exit) and CPU_SWITCH (terminated) end the quantum at once
  * returns 0 if there is no process to run, 1 otherwise
  */
 int schedule(int cycle_num, int process_status) {
+    sched_cycle = cycle_num;
     if (ready_queue_empty()) {
         current = NULL;
         return 0;
     }
 
-    if (process_status == 0) {
-        remove_head_process();
+    if (process_status == 0 || process_status == CPU_SWITCH || !current) {
+        /* a process that faulted has already been removed; don't take the next one with it */
+        if (process_status == 0 && current) remove_head_process();
         if (ready_queue_empty()) {
             current = NULL;
             return 0;
         }
         scheduler_context_switch();
-        last_cycle_checkpoint = cycle_num; //start new quantum
+        last_cycle_checkpoint = cycle_num + switch_stall; //start new quantum once it is swapped in
         return 1;
     }
 
@@ -246,12 +419,81 @@ int schedule(int cycle_num, int process_status) {
     if ((cycle_num - last_cycle_checkpoint) >= time_quantum) {
         next_process();
         scheduler_context_switch();
-        last_cycle_checkpoint = cycle_num;
+        last_cycle_checkpoint = cycle_num + switch_stall;
     }
 
     return 1;
 }
 
+/* Copy up to `max` ready PCB pointers (queue order) into `out`.
+ * Returns the number of ready processes; pass out=NULL to just count.
+ */
+int scheduler_ready_pcbs(PCB **out, int max) {
+    int n = 0;
+    for (ReadyNode *cur = ready_head; cur; cur = cur->next) {
+        if (out && n < max) out[n] = cur->pcb;
+        n++;
+    }
+    return n;
+}
+
+/* Number of times a process was switched in; changes at every new quantum. */
+long scheduler_switch_count(void) {
+    return switches;
+}
+
+/* Number of processes in the ready queue (the running one included). */
+int scheduler_ready_count(void) {
+    return ready_count;
+}
+
+/* PCB queued right in front of p, the tail if p is NULL; NULL at the head
+ * or if p is not ready. */
+PCB *scheduler_ready_prev(PCB *p) {
+    if (!p) return ready_tail ? ready_tail->pcb : NULL;
+    if (p->pid < 0 || p->pid >= node_cap || !ready_node[p->pid]) return NULL;
+    ReadyNode *prev = ready_node[p->pid]->prev;
+    return prev ? prev->pcb : NULL;
+}
+
+/* PCB of a live process, NULL if pid is not in use. */
+PCB *scheduler_get_pcb(int pid) {
+    if (pid < 0 || !pid_occupied(pid)) return NULL;
+    return process_table[pid];
+}
+
+/* Save the CPU registers into the running PCB and leave no process
+ * current, so other engines can work on the PCBs directly.
+ */
+void scheduler_park_current(void) {
+    if (!current) return;
+    register_struct none = {0};
+    register_struct old_vals = context_switch(none);
+    current->base = old_vals.Base;
+    current->pc = (uint32_t)old_vals.PC;
+    current->registers[0] = (uint32_t)old_vals.AC;
+    current->registers[1] = (uint32_t)old_vals.MAR;
+    current->registers[2] = (uint32_t)old_vals.MBR;
+    current->registers[3] = (uint32_t)old_vals.IR0;
+    current->registers[4] = (uint32_t)old_vals.IR1;
+    current->sp = (uint32_t)old_vals.SP;
+    current = NULL;
+}
+
+/* Load the head of the ready queue after scheduler_park_current()
+ * and start a fresh quantum at cycle_num.
+ */
+void scheduler_resume(int cycle_num) {
+    scheduler_context_switch();
+    last_cycle_checkpoint = cycle_num + switch_stall;
+}
+
+/* Cycles the running process may still use before schedule() preempts it. */
+int scheduler_quantum_left(int cycle_num) {
+    int left = time_quantum - (cycle_num - last_cycle_checkpoint);
+    return left > 0 ? left : 0;
+}
+
 PCB *scheduler_get_current(void) {
     return current;
 }
@@ -7,7 +7,9 @@
 extern "C" {
 #endif
 
-#define MAX_PROCESSES 1024
+/* PCB flags */
+#define PCB_SWAPPED 0x1  /* partition lives in the swap file, base is stale */
+#define PCB_VERIFIED 0x2 /* proven at load time never to leave its partition (verify.c) */
 
 extern int time_quantum;
 
@@ -19,11 +21,13 @@ typedef struct PCB {
     uint32_t registers[8];
     uint32_t sp;
     uint32_t flags;
+    int arrival;     /* cycle the process was created at */
 } PCB;
 
 typedef struct ReadyNode {
     PCB *pcb;
     struct ReadyNode *next;
+    struct ReadyNode *prev;
 } ReadyNode;
 
 void new_process(int base, int size);
@@ -33,9 +37,19 @@ int schedule(int cycle_num, int process_status);
 void scheduler_context_switch(void);
 int ready_queue_empty(void);
 void remove_process_from_ready(int pid);
+void scheduler_finish_process(int pid);
 int get_current_pid(void);
 int scheduler_get_free_pid(void);
 void create_process_with_pid(int pid, int base, int size);
+int scheduler_ready_pcbs(PCB **out, int max);
+int scheduler_ready_count(void);
+PCB *scheduler_ready_prev(PCB *p);
+long scheduler_switch_count(void);
+void scheduler_park_current(void);
+void scheduler_resume(int cycle_num);
+int scheduler_quantum_left(int cycle_num);
+PCB *scheduler_get_pcb(int pid);
+void scheduler_set_exit_hook(void (*hook)(PCB *p, int faulted, int cycle_num));
 
 #ifdef __cplusplus
 }
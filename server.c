@@ -0,0 +1,553 @@
+/**
+ * server.c
+ * Persistent simulator daemon taking jobs over a Unix domain socket.
+ *
+ * server_start() binds the socket and starts an accept thread. Every
+ * connection gets a reader thread, which parses requests, reads and
+ * translates the programs into images and pushes them as jobs onto a
+ * lock-free multi-producer/single-consumer queue (mpsc.c), and a writer
+ * thread, which streams the replies back as they are produced. The
+ * simulation thread drains the queue from server_poll() between clock
+ * cycles, admits jobs in arrival order and reports each job's exit from
+ * the scheduler's exit hook, so SMM, memory and the scheduler stay on
+ * one thread as with the parallel loader.
+ *
+ * Requests, one per line:
+ *   prog <size> <file>     a program file on the server's side
+ *   list <file>            a program list; relative program names are
+ *                          looked up next to the list
+ *   image <size> <name>    program text sent inline, ended by a "." line
+ *   shutdown               stop once every accepted job has finished
+ * Replies:
+ *   accepted <job> <name>
+ *   result <job> <name> pid <pid> exit|fault ac <AC> mar <MAR> mbr <MBR> cycles <n>
+ *   error <message>
+ *   done <jobs>            the client closed its side and all its jobs finished
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "mpsc.h"
+#include "disk.h"
+#include "scheduler.h"
+#include "table.h"
+
+char server_socket[] = "program2.sock"; /* default path for --serve */
+
+struct conn {
+    int fd;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    char *out;              /* replies not written yet */
+    size_t out_len, out_cap;
+    int submitted;          /* jobs accepted */
+    int finished;           /* jobs with a result */
+    int reading;            /* the reader thread is still running */
+};
+
+struct job {
+    struct mpsc_node node;  /* first, so a popped node is the job */
+    struct conn *conn;
+    int id;
+    int size;
+    char *name;
+    int (*text)[2];
+    int count;
+    int admit_cycle;
+    struct job *next;       /* pending list */
+};
+
+static struct mpsc_queue job_queue;
+static atomic_int queued = 0;          /* pushed, not popped yet */
+static int doorbell[2] = { -1, -1 };  /* a byte per push wakes a waiting server_poll() */
+static int listen_fd = -1;
+static char listen_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pthread_t accept_thread;
+static int accepting = 0;
+static atomic_int stopping = 0;
+static atomic_int next_id = 0;
+static atomic_int open_conns = 0;
+static atomic_int total_conns = 0;
+
+/* simulation thread only */
+static struct job *pending_head = NULL, *pending_tail = NULL;
+static int blocked = 0;                /* the head did not fit; retry after an exit */
+static struct job **running = NULL;    /* job of each PID */
+static int running_cap = 0;
+static int nrunning = 0;
+static long jobs_exited = 0, jobs_faulted = 0, jobs_rejected = 0;
+static long jobs_failed = 0;           /* admit_image() could not load them at all */
+
+/* append to c's replies; c->lock must be held */
+static void append_reply(struct conn *c, const char *s, size_t len)
+{
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap * 2 : 1024;
+        while (cap < c->out_len + len) cap *= 2;
+        char *grown = realloc(c->out, cap);
+        if (!grown) return; /* the reply is lost, the job still counts */
+        c->out = grown;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, s, len);
+    c->out_len += len;
+    pthread_cond_signal(&c->changed);
+}
+
+static void reply(struct conn *c, const char *fmt, ...)
+{
+    char line[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len < 0) return;
+    if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+    pthread_mutex_lock(&c->lock);
+    append_reply(c, line, len);
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* post the job's last reply and free it; the connection may go away right after */
+static void finish_job(struct job *j, const char *fmt, ...)
+{
+    char line[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+
+    struct conn *c = j->conn;
+    pthread_mutex_lock(&c->lock);
+    if (len > 0) append_reply(c, line, len);
+    c->finished++;
+    pthread_cond_signal(&c->changed);
+    pthread_mutex_unlock(&c->lock);
+
+    free(j->text);
+    free(j->name);
+    free(j);
+}
+
+static void ring_doorbell(void)
+{
+    char b = 1;
+    if (write(doorbell[1], &b, 1) < 0) {
+        /* pipe full: a wakeup is pending anyway */
+    }
+}
+
+/* hand a translated program to the simulation thread; takes text */
+static void submit(struct conn *c, const char *name, int size, int (*text)[2], int count)
+{
+    struct job *j = calloc(1, sizeof(*j));
+    if (j) j->name = strdup(name);
+    if (!j || !j->name) {
+        reply(c, "error out of memory for %s\n", name);
+        free(j);
+        free(text);
+        return;
+    }
+    /* counted before the check, so a shutdown never misses a push in flight */
+    atomic_fetch_add(&queued, 1);
+    if (atomic_load(&stopping)) {
+        atomic_fetch_sub(&queued, 1);
+        reply(c, "error server is shutting down, %s not accepted\n", name);
+        free(j->name);
+        free(j);
+        free(text);
+        return;
+    }
+    j->conn = c;
+    j->id = atomic_fetch_add(&next_id, 1);
+    j->size = size;
+    j->text = text;
+    j->count = count;
+
+    pthread_mutex_lock(&c->lock);
+    c->submitted++;
+    pthread_mutex_unlock(&c->lock);
+    reply(c, "accepted %d %s\n", j->id, name); /* before the result can be posted */
+    mpsc_push(&job_queue, &j->node);
+    ring_doorbell();
+}
+
+static void submit_file(struct conn *c, char *fname, int size)
+{
+    if (size <= 0) {
+        reply(c, "error bad size %d for %s\n", size, fname);
+        return;
+    }
+    int count = 0;
+    int (*text)[2] = read_image(fname, &count);
+    if (!text) {
+        reply(c, "error cannot read program %s\n", fname);
+        return;
+    }
+    submit(c, fname, size, text, count);
+}
+
+/* every "size file" line of a program list */
+static void submit_list(struct conn *c, char *list_fname)
+{
+    FILE *f = fopen(list_fname, "r");
+    if (!f) {
+        reply(c, "error cannot read list %s\n", list_fname);
+        return;
+    }
+    const char *slash = strrchr(list_fname, '/');
+    int dir_len = slash ? (int)(slash - list_fname) + 1 : 0;
+
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0' || (p[0] == '/' && p[1] == '/')) continue;
+        int size = 0;
+        char fname[256], path[512];
+        if (sscanf(p, "%d %255s", &size, fname) != 2) continue;
+        if (fname[0] == '/') snprintf(path, sizeof(path), "%s", fname);
+        else snprintf(path, sizeof(path), "%.*s%s", dir_len, list_fname, fname);
+        submit_file(c, path, size);
+    }
+    fclose(f);
+}
+
+/* program text follows on the connection up to a "." line */
+static void submit_inline(struct conn *c, FILE *in, char *name, int size)
+{
+    int (*text)[2] = NULL;
+    int count = 0, cap = 0, ok = 1, ended = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), in)) {
+        char *p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (p[0] == '.' && (p[1] == '\0' || isspace((unsigned char)p[1]))) {
+            ended = 1;
+            break;
+        }
+        int ins[2];
+        if (!ok || !translate_into(line, ins)) continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            int (*grown)[2] = realloc(text, cap * sizeof(text[0]));
+            if (!grown) {
+                ok = 0;
+                continue;
+            }
+            text = grown;
+        }
+        text[count][0] = ins[0];
+        text[count][1] = ins[1];
+        count++;
+    }
+    if (!ended || !ok || count == 0 || size <= 0) {
+        reply(c, "error image %s: %s\n", name,
+              !ended ? "missing \".\" line" : !ok ? "out of memory" : count == 0 ? "no instructions" : "bad size");
+        free(text);
+        return;
+    }
+    submit(c, name, size, text, count);
+}
+
+static void handle_request(struct conn *c, FILE *in, char *req)
+{
+    int size = 0;
+    char name[256];
+    if (sscanf(req, "prog %d %255s", &size, name) == 2) {
+        submit_file(c, name, size);
+    } else if (sscanf(req, "list %255s", name) == 1) {
+        submit_list(c, name);
+    } else if (sscanf(req, "image %d %255s", &size, name) == 2) {
+        submit_inline(c, in, name, size);
+    } else if (strcmp(req, "shutdown") == 0) {
+        atomic_store(&stopping, 1);
+        ring_doorbell();
+        reply(c, "ok shutting down\n");
+    } else {
+        reply(c, "error unknown request '%s'\n", req);
+    }
+}
+
+static void *reader_main(void *arg)
+{
+    struct conn *c = arg;
+    int fd = dup(c->fd); /* fclose() must not close the writer's descriptor */
+    FILE *in = fd >= 0 ? fdopen(fd, "r") : NULL;
+    if (in) {
+        char line[512];
+        while (fgets(line, sizeof(line), in)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            char *p = line;
+            while (isspace((unsigned char)*p)) p++;
+            if (*p) handle_request(c, in, p);
+        }
+        fclose(in);
+    } else if (fd >= 0) {
+        close(fd);
+    }
+
+    pthread_mutex_lock(&c->lock);
+    c->reading = 0;
+    pthread_cond_signal(&c->changed);
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+static void *writer_main(void *arg)
+{
+    struct conn *c = arg;
+    int ok = 1; /* stop writing once the client is gone, but keep draining */
+
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+        while (c->out_len == 0 && (c->reading || c->finished < c->submitted)) {
+            pthread_cond_wait(&c->changed, &c->lock);
+        }
+        if (c->out_len == 0) break;
+        char *buf = c->out;
+        size_t len = c->out_len;
+        c->out = NULL;
+        c->out_len = c->out_cap = 0;
+        pthread_mutex_unlock(&c->lock);
+        if (ok) ok = write_all(c->fd, buf, len);
+        free(buf);
+        pthread_mutex_lock(&c->lock);
+    }
+    int jobs = c->submitted;
+    pthread_mutex_unlock(&c->lock);
+
+    if (ok) {
+        char line[64];
+        int len = snprintf(line, sizeof(line), "done %d\n", jobs);
+        write_all(c->fd, line, len);
+    }
+    close(c->fd);
+    pthread_cond_destroy(&c->changed);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+    atomic_fetch_sub(&open_conns, 1);
+    return NULL;
+}
+
+static void *accept_main(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break; /* closed by server_stop() */
+        }
+        struct conn *c = calloc(1, sizeof(*c));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->reading = 1;
+        pthread_mutex_init(&c->lock, NULL);
+        pthread_cond_init(&c->changed, NULL);
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        pthread_t reader, writer;
+        if (pthread_create(&reader, &attr, reader_main, c) != 0) {
+            pthread_cond_destroy(&c->changed);
+            pthread_mutex_destroy(&c->lock);
+            close(fd);
+            free(c);
+        } else {
+            atomic_fetch_add(&open_conns, 1);
+            atomic_fetch_add(&total_conns, 1);
+            /* without a writer the replies are dropped, but the reader must not be left alone */
+            if (pthread_create(&writer, &attr, writer_main, c) != 0) {
+                fprintf(stderr, "server: cannot start a writer thread\n");
+                shutdown(fd, SHUT_RDWR);
+            }
+        }
+        pthread_attr_destroy(&attr);
+    }
+    return NULL;
+}
+
+/* scheduler exit hook: report the job the process was running, if any */
+static void job_exit(PCB *p, int faulted, int cycle_num)
+{
+    blocked = 0; /* memory was freed */
+    if (p->pid < 0 || p->pid >= running_cap || !running[p->pid]) return;
+    struct job *j = running[p->pid];
+    running[p->pid] = NULL;
+    nrunning--;
+    if (faulted) jobs_faulted++;
+    else jobs_exited++;
+    finish_job(j, "result %d %s pid %d %s ac %d mar %d mbr %d cycles %d\n",
+               j->id, j->name, p->pid, faulted ? "fault" : "exit",
+               (int)p->registers[0], (int)p->registers[1], (int)p->registers[2],
+               cycle_num - j->admit_cycle);
+}
+
+/**
+ * bind path and start accepting connections. a stale socket left by a
+ * previous run is replaced. returns 0 if the socket cannot be set up
+ */
+int server_start(const char *path)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "server: socket path %s is too long\n", path);
+        return 0;
+    }
+    mpsc_init(&job_queue);
+    if (pipe(doorbell) < 0) {
+        perror("server: pipe");
+        return 0;
+    }
+    fcntl(doorbell[0], F_SETFL, O_NONBLOCK);
+    fcntl(doorbell[1], F_SETFL, O_NONBLOCK);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("server: socket");
+        return 0;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 16) < 0) {
+        fprintf(stderr, "server: cannot listen on %s: %s\n", path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return 0;
+    }
+    strcpy(listen_path, path);
+
+    scheduler_set_exit_hook(job_exit);
+    if (pthread_create(&accept_thread, NULL, accept_main, NULL) != 0) {
+        fprintf(stderr, "server: cannot start the accept thread\n");
+        server_stop();
+        return 0;
+    }
+    accepting = 1;
+    printf("Listening on %s\n", path);
+    return 1;
+}
+
+/* 1 until a shutdown was requested and every accepted job has finished */
+int server_running(void)
+{
+    if (!atomic_load(&stopping)) return 1;
+    return atomic_load(&queued) > 0 || pending_head || nrunning > 0 || !ready_queue_empty();
+}
+
+/**
+ * take new jobs off the queue and admit waiting ones in arrival order.
+ * with wait != 0 this blocks until there is something to run (the CPU
+ * is idle). returns the number of processes admitted
+ */
+int server_poll(int cycle_num, int wait)
+{
+    int admitted = 0;
+    for (;;) {
+        struct job *j;
+        while ((j = (struct job *)mpsc_pop(&job_queue)) != NULL) {
+            atomic_fetch_sub(&queued, 1);
+            j->next = NULL;
+            if (pending_tail) pending_tail->next = j;
+            else pending_head = j;
+            pending_tail = j;
+            blocked = 0;
+        }
+
+        while (pending_head && !blocked) {
+            j = pending_head;
+            int rc = admit_image(j->name, j->size, j->text, j->count, cycle_num);
+            if (rc == 0 && !ready_queue_empty()) {
+                blocked = 1; /* wait until a process exits */
+                break;
+            }
+            pending_head = j->next;
+            if (!pending_head) pending_tail = NULL;
+            if (rc > 0) {
+                int pid = admitted_pid();
+                if (!table_reserve((void **)&running, &running_cap, pid, sizeof(*running))) {
+                    finish_job(j, "error job %d %s: out of memory to track it\n", j->id, j->name);
+                    continue;
+                }
+                free(j->text);
+                j->text = NULL;
+                j->admit_cycle = cycle_num;
+                running[pid] = j;
+                nrunning++;
+                admitted++;
+            } else if (rc < 0) {
+                jobs_failed++;
+                finish_job(j, "error job %d %s: could not be loaded (no free PID or internal error)\n", j->id, j->name);
+            } else {
+                /* nothing is running, so no memory will ever be freed for it */
+                jobs_rejected++;
+                finish_job(j, "error job %d %s: %d words do not fit in memory\n", j->id, j->name, j->size);
+            }
+        }
+
+        if (admitted || !wait || !ready_queue_empty() || !server_running()) break;
+        struct pollfd pfd = { doorbell[0], POLLIN, 0 };
+        poll(&pfd, 1, 200);
+        char drain[64];
+        while (read(doorbell[0], drain, sizeof(drain)) > 0) {
+        }
+    }
+    return admitted;
+}
+
+/* stop accepting connections and remove the socket */
+void server_stop(void)
+{
+    atomic_store(&stopping, 1);
+    scheduler_set_exit_hook(NULL);
+    if (listen_fd >= 0) {
+        shutdown(listen_fd, SHUT_RDWR); /* wakes the accept thread */
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(listen_path);
+    }
+    if (accepting) {
+        pthread_join(accept_thread, NULL);
+        accepting = 0;
+    }
+    /* give clients a moment to read their last results */
+    for (int i = 0; i < 100 && atomic_load(&open_conns) > 0; ++i) usleep(10000);
+}
+
+void print_server_stats(void)
+{
+    printf("Server: %d connections, %d jobs accepted, %ld exited, %ld faulted, %ld rejected, %ld failed to load\n",
+           atomic_load(&total_conns), atomic_load(&next_id), jobs_exited, jobs_faulted, jobs_rejected, jobs_failed);
+}
@@ -0,0 +1,16 @@
+/**
+ * server.h
+ * Persistent simulator daemon taking jobs over a Unix domain socket.
+ */
+#ifndef SERVER_H
+#define SERVER_H
+
+extern char server_socket[];
+
+int server_start(const char *path);
+int server_running(void);
+int server_poll(int cycle_num, int wait);
+void server_stop(void);
+void print_server_stats(void);
+
+#endif
@@ -1,91 +1,386 @@
 /*
  * smm.c
  * Simple Memory Manager (dynamic partitioning, first-fit)
+ *
+ * Holes are kept in two side arrays over physical memory instead of a
+ * list. hole_end[] is a boundary tag on the last word of every hole (its
+ * base), so a freed partition finds the hole ending right before it in
+ * O(1); the hole starting right after it is a leaf of hole_tree, a
+ * max-segment-tree indexed by address whose leaves hold the size of the
+ * hole starting there. Holes are therefore coalesced as they are added,
+ * and first fit (the lowest hole large enough) is a walk down the tree in
+ * O(log MEM_SIZE), however many holes there are.
+ *
+ * Safe to call from any thread. The hole index and the telemetry are
+ * guarded by smm_lock. The allocation table is read without locking:
+ * each row is a single atomic word in chunks that never move, found
+ * through a directory that is copied when it grows and published with a
+ * release store, so get_base_address() and is_allowed_address() (on every
+ * memory access) stay lock-free for any PID. With smm_cache_words > 0, partitions up to that size
+ * are freed into a small cache owned by the freeing thread and reused by
+ * its next allocations without touching smm_lock; when the hole index
+ * cannot satisfy a request, every cache is flushed back into it first.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "smm.h"
+#include "table.h"
 
 /* Try to respect an external memory size if provided; default to 256 */
 #ifndef MEM_SIZE
 #define MEM_SIZE 1024
 #endif
 
-struct hole {
-    int base;
-    int size;
-    struct hole *next;
+/* hole_tree[1] is the root (the largest hole), leaves at tree_cap + base;
+ * hole_end[a] is the base of the hole whose last word is a, -1 if none */
+static int *hole_tree = NULL;
+static int tree_cap = 0;
+static int *hole_end = NULL;
+
+/* Allocation table indexed by PID: base in the high half of each row,
+ * size in the low half (0 = none). Chunks are added on first use and
+ * never moved, so rows can be read while another thread allocates. A
+ * directory that grows is replaced by a larger copy; the old one stays
+ * readable (on the prev chain) for threads still looking through it. */
+#define SMM_ROWS_PER_CHUNK 256
+#define SMM_MIN_CHUNKS 16
+
+struct chunk_dir {
+    int cap;
+    struct chunk_dir *prev;                /* replaced directories, never freed */
+    _Atomic uint64_t *_Atomic chunks[];
 };
 
-/* Head of holes linked list (sorted by base address) */
-static struct hole *holes_head = NULL;
+static struct chunk_dir *_Atomic alloc_dir = NULL;
+static pthread_mutex_t dir_lock = PTHREAD_MUTEX_INITIALIZER; /* serializes growing and adding chunks */
 
-/* Allocation table: [row][0]=pid, [row][1]=base, [row][2]=size */
-static int alloc_table[256][3];
+/* Count of times deallocate() creates a new hole (global as required) */
+static atomic_int new_hole_count = 0;
+static pthread_once_t smm_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t smm_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* Count of times a new hole is created (global as required) */
-static int new_hole_count = 0;
-static int smm_initialized = 0;
+/* Per-thread caches of freed small partitions */
+#define SMM_CACHE_SLOTS 16
 
-static void smm_init(void);
-void print_new_hole_count(void) { printf("SMM: new holes created: %d\n", new_hole_count); }
+int smm_cache_words = 0; /* partitions up to this size go through thread caches; 0: off */
 
-static void smm_init(void)
+struct smm_cache {
+    pthread_mutex_t lock;   /* only contended while another thread flushes */
+    int n;
+    int base[SMM_CACHE_SLOTS];
+    int size[SMM_CACHE_SLOTS];
+    struct smm_cache *next; /* every cache ever made, so any thread can flush them */
+};
+
+static _Thread_local struct smm_cache *my_cache = NULL;
+static struct smm_cache *caches = NULL; /* guarded by smm_lock */
+static atomic_long cache_hits = 0;
+static atomic_long cache_flushes = 0;
+
+/* Called with the size of the (merged) hole every time memory is freed */
+static void (*free_hook)(int hole_size) = NULL;
+
+/* Called with the partition every time deallocate() gives one back */
+static void (*release_hook)(int base, int size) = NULL;
+
+/* Fragmentation telemetry. The counters follow every change to the hole
+ * index and alloc_table, so a sample is a copy and never a rescan. */
+#define SMM_SIZE_CLASSES 16 /* class k: partitions of 2^k .. 2^(k+1)-1 words */
+
+int smm_telemetry_enabled = 0; /* set to 1 to record a fragmentation time series */
+int smm_sample_period = 100;   /* cycles between samples */
+char smm_telemetry_file[] = "smm_telemetry.csv";
+
+/* written under smm_lock, read with relaxed loads by smm_free_space() */
+static atomic_int hole_count = 0;
+static atomic_int free_words = 0;
+static atomic_int largest_free = 0;              /* hole_tree[1] */
+static atomic_int partitions = 0;                /* updated outside smm_lock on cache hits */
+static atomic_int alloc_class[SMM_SIZE_CLASSES];
+
+struct smm_sample {
+    int cycle;
+    int holes;
+    int free_words;
+    int largest;
+    int partitions;
+    int alloc_class[SMM_SIZE_CLASSES];
+};
+
+static struct smm_sample *samples = NULL;
+static int nsamples = 0, samples_cap = 0;
+static int next_sample = 0;
+static int peak_holes = 0;
+static double peak_frag = 0.0;
+
+/* the leaf for base now says size (0: no hole starts there) */
+static void tree_set(int base, int size)
 {
-    if (smm_initialized) return;
-    /* initialize allocation table to zeros */
-    memset(alloc_table, 0, sizeof(alloc_table));
+    int i = tree_cap + base;
+    hole_tree[i] = size;
+    for (i /= 2; i >= 1; i /= 2) {
+        hole_tree[i] = hole_tree[2 * i] > hole_tree[2 * i + 1] ? hole_tree[2 * i] : hole_tree[2 * i + 1];
+    }
+    atomic_store_explicit(&largest_free, hole_tree[1], memory_order_relaxed);
+}
 
-    /* start with one big hole covering memory */
-    holes_head = (struct hole*)malloc(sizeof(struct hole));
-    if (!holes_head) {
-        fprintf(stderr, "SMM: failed to initialize hole list (malloc)\n");
+/* lowest base of a hole of at least size words, or -1 */
+static int tree_first_fit(int size)
+{
+    if (hole_tree[1] < size) return -1;
+    int i = 1;
+    while (i < tree_cap) i = hole_tree[2 * i] >= size ? 2 * i : 2 * i + 1;
+    return i - tree_cap;
+}
+
+/* size of the hole starting at base, 0 if there is none */
+static int hole_at(int base)
+{
+    return base >= 0 && base < MEM_SIZE ? hole_tree[tree_cap + base] : 0;
+}
+
+static void hole_put(int base, int size)
+{
+    tree_set(base, size);
+    hole_end[base + size - 1] = base;
+    atomic_fetch_add_explicit(&hole_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&free_words, size, memory_order_relaxed);
+}
+
+/* take the hole starting at base out of the index; returns its size */
+static int hole_take(int base)
+{
+    int size = hole_at(base);
+    if (size == 0) return 0;
+    tree_set(base, 0);
+    hole_end[base + size - 1] = -1;
+    atomic_fetch_sub_explicit(&hole_count, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&free_words, size, memory_order_relaxed);
+    return size;
+}
+
+static int size_class(int size)
+{
+    int k = 0;
+    while (size > 1 && k < SMM_SIZE_CLASSES - 1) {
+        size >>= 1;
+        k++;
+    }
+    return k;
+}
+
+/* 1 - largest hole / free words: 0 when all free memory is one hole */
+static double ext_fragmentation(int largest_hole, int free_total)
+{
+    return free_total > 0 ? 1.0 - (double)largest_hole / free_total : 0.0;
+}
+
+void print_new_hole_count(void) { printf("SMM: new holes created: %d\n", atomic_load(&new_hole_count)); }
+
+static void smm_init_once(void)
+{
+    tree_cap = 1;
+    while (tree_cap < MEM_SIZE) tree_cap *= 2;
+    hole_tree = (int *)calloc(2 * tree_cap, sizeof(int));
+    hole_end = (int *)malloc(MEM_SIZE * sizeof(int));
+    if (!hole_tree || !hole_end) {
+        fprintf(stderr, "SMM: failed to initialize hole index (malloc)\n");
         exit(1);
     }
-    holes_head->base = 0;
-    holes_head->size = MEM_SIZE;
-    holes_head->next = NULL;
+    for (int a = 0; a < MEM_SIZE; ++a) hole_end[a] = -1;
+
+    /* start with one big hole covering memory */
+    hole_put(0, MEM_SIZE);
 
     /* register at-exit printer for new_hole_count */
     atexit(print_new_hole_count);
+}
 
-    smm_initialized = 1;
+static void smm_init(void)
+{
+    pthread_once(&smm_once, smm_init_once);
 }
 
-int find_empty_row(void)
+static uint64_t pack_row(int base, int size)
 {
-    smm_init();
-    for (int i = 0; i < 256; ++i) {
-        if (alloc_table[i][2] == 0) return i;
+    return ((uint64_t)(uint32_t)base << 32) | (uint32_t)size;
+}
+
+static int row_base(uint64_t row) { return (int)(uint32_t)(row >> 32); }
+static int row_size(uint64_t row) { return (int)(uint32_t)row; }
+
+/* chunk k of the directory, made (and the directory grown) if needed; dir_lock held */
+static _Atomic uint64_t *add_chunk_locked(int k)
+{
+    struct chunk_dir *dir = atomic_load_explicit(&alloc_dir, memory_order_relaxed);
+    if (!dir || k >= dir->cap) {
+        int cap = dir ? dir->cap : SMM_MIN_CHUNKS;
+        while (cap <= k) cap *= 2;
+        struct chunk_dir *grown = calloc(1, sizeof(*grown) + cap * sizeof(grown->chunks[0]));
+        if (!grown) return NULL;
+        grown->cap = cap;
+        grown->prev = dir;
+        for (int i = 0; dir && i < dir->cap; ++i) {
+            grown->chunks[i] = atomic_load_explicit(&dir->chunks[i], memory_order_relaxed);
+        }
+        atomic_store_explicit(&alloc_dir, grown, memory_order_release);
+        dir = grown;
     }
-    return -1;
+    _Atomic uint64_t *chunk = atomic_load_explicit(&dir->chunks[k], memory_order_relaxed);
+    if (!chunk) {
+        chunk = calloc(SMM_ROWS_PER_CHUNK, sizeof(*chunk));
+        if (chunk) atomic_store_explicit(&dir->chunks[k], chunk, memory_order_release);
+    }
+    return chunk;
 }
 
-int find_hole(int size)
+/* pid's row of the allocation table; NULL if it does not exist (and create is 0) */
+static _Atomic uint64_t *alloc_row(int pid, int create)
 {
-    smm_init();
-    struct hole *prev = NULL;
-    struct hole *cur = holes_head;
-    while (cur) {
-        if (cur->size >= size) {
-            int base = cur->base;
-            if (cur->size == size) {
-                /* remove this hole */
-                if (prev) prev->next = cur->next;
-                else holes_head = cur->next;
-                free(cur);
-            } else {
-                /* shrink hole from front */
-                cur->base += size;
-                cur->size -= size;
-            }
-            return base;
+    if (pid < 0) return NULL;
+    int k = pid / SMM_ROWS_PER_CHUNK;
+    struct chunk_dir *dir = atomic_load_explicit(&alloc_dir, memory_order_acquire);
+    _Atomic uint64_t *chunk = dir && k < dir->cap ? atomic_load_explicit(&dir->chunks[k], memory_order_acquire) : NULL;
+    if (!chunk && create) {
+        pthread_mutex_lock(&dir_lock);
+        chunk = add_chunk_locked(k);
+        pthread_mutex_unlock(&dir_lock);
+    }
+    return chunk ? &chunk[pid % SMM_ROWS_PER_CHUNK] : NULL;
+}
+
+static uint64_t load_row(int pid)
+{
+    _Atomic uint64_t *row = alloc_row(pid, 0);
+    return row ? atomic_load_explicit(row, memory_order_acquire) : 0;
+}
+
+/* The calling thread's cache, made on first use; NULL if out of memory */
+static struct smm_cache *thread_cache(void)
+{
+    if (my_cache) return my_cache;
+    struct smm_cache *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_mutex_lock(&smm_lock);
+    c->next = caches;
+    caches = c;
+    pthread_mutex_unlock(&smm_lock);
+    my_cache = c;
+    return c;
+}
+
+/* best-fitting cached partition for size words, split from the front; -1 if none */
+static int cache_take(int size)
+{
+    struct smm_cache *c = my_cache;
+    if (!c) return -1;
+    pthread_mutex_lock(&c->lock);
+    int best = -1;
+    for (int i = 0; i < c->n; ++i) {
+        if (c->size[i] >= size && (best < 0 || c->size[i] < c->size[best])) best = i;
+    }
+    int base = -1;
+    if (best >= 0) {
+        base = c->base[best];
+        c->base[best] += size;
+        c->size[best] -= size;
+        if (c->size[best] == 0) {
+            c->n--;
+            c->base[best] = c->base[c->n];
+            c->size[best] = c->size[c->n];
         }
-        prev = cur;
-        cur = cur->next;
     }
-    return -1; /* no suitable hole */
+    pthread_mutex_unlock(&c->lock);
+    return base;
+}
+
+/* keep a freed partition in the calling thread's cache; 0 if it is full */
+static int cache_put(int base, int size)
+{
+    struct smm_cache *c = thread_cache();
+    if (!c) return 0;
+    pthread_mutex_lock(&c->lock);
+    int kept = c->n < SMM_CACHE_SLOTS;
+    if (kept) {
+        c->base[c->n] = base;
+        c->size[c->n] = size;
+        c->n++;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return kept;
+}
+
+static int insert_hole_locked(int base, int size);
+
+/* move every cached partition back into the hole index; smm_lock held.
+ * returns the number of partitions moved */
+static int flush_caches_locked(void)
+{
+    int moved = 0;
+    for (struct smm_cache *c = caches; c; c = c->next) {
+        pthread_mutex_lock(&c->lock);
+        for (int i = 0; i < c->n; ++i) insert_hole_locked(c->base[i], c->size[i]);
+        moved += c->n;
+        c->n = 0;
+        pthread_mutex_unlock(&c->lock);
+    }
+    if (moved > 0) atomic_fetch_add_explicit(&cache_flushes, 1, memory_order_relaxed);
+    return moved;
+}
+
+static int find_hole_locked(int size)
+{
+    int base = tree_first_fit(size);
+    if (base < 0) return -1; /* no suitable hole */
+    int have = hole_take(base);
+    if (have > size) hole_put(base + size, have - size); /* shrink hole from front */
+    return base;
+}
+
+int find_hole(int size)
+{
+    smm_init();
+    pthread_mutex_lock(&smm_lock);
+    int base = find_hole_locked(size);
+    pthread_mutex_unlock(&smm_lock);
+    return base;
+}
+
+/* Return 1 if some hole could satisfy a request of `size` words (nothing is taken). */
+int can_allocate(int size)
+{
+    smm_init();
+    pthread_mutex_lock(&smm_lock);
+    int ok = hole_tree[1] >= size;
+    if (!ok && flush_caches_locked() > 0) ok = hole_tree[1] >= size;
+    pthread_mutex_unlock(&smm_lock);
+    return ok;
+}
+
+/* Size of the largest hole, 0 if memory is full. Cached partitions count as holes. */
+int largest_hole(void)
+{
+    smm_init();
+    pthread_mutex_lock(&smm_lock);
+    flush_caches_locked();
+    int best = hole_tree[1];
+    pthread_mutex_unlock(&smm_lock);
+    return best;
+}
+
+void smm_set_free_hook(void (*hook)(int hole_size))
+{
+    free_hook = hook;
+}
+
+void smm_set_release_hook(void (*hook)(int base, int size))
+{
+    release_hook = hook;
 }
 
 int allocate(int pid, int size)
@@ -93,22 +388,39 @@ int allocate(int pid, int size)
     smm_init();
     if (size <= 0) return 0;
 
-    int row = find_empty_row();
-    if (row == -1) {
+    _Atomic uint64_t *row = alloc_row(pid, 1);
+    if (!row) {
         fprintf(stderr, "SMM: allocation failed for PID %d (no free table row)\n", pid);
         return 0;
     }
+    if (row_size(atomic_load_explicit(row, memory_order_acquire)) > 0) {
+        fprintf(stderr, "SMM: allocation failed for PID %d (already holds a partition)\n", pid);
+        return 0;
+    }
 
-    int base = find_hole(size);
+    int base = size <= smm_cache_words ? cache_take(size) : -1;
+    if (base >= 0) {
+        atomic_fetch_add_explicit(&cache_hits, 1, memory_order_relaxed);
+    } else {
+        pthread_mutex_lock(&smm_lock);
+        base = find_hole_locked(size);
+        if (base == -1 && flush_caches_locked() > 0) base = find_hole_locked(size);
+        pthread_mutex_unlock(&smm_lock);
+    }
     if (base == -1) {
         fprintf(stderr, "SMM: allocation failed for PID %d (no hole large enough for %d)\n", pid, size);
         return 0;
     }
 
     /* fill allocation table row */
-    alloc_table[row][0] = pid;
-    alloc_table[row][1] = base;
-    alloc_table[row][2] = size;
+    uint64_t none = 0;
+    if (!atomic_compare_exchange_strong(row, &none, pack_row(base, size))) {
+        fprintf(stderr, "SMM: allocation failed for PID %d (already holds a partition)\n", pid);
+        add_hole(base, size); /* another thread allocated for pid meanwhile */
+        return 0;
+    }
+    atomic_fetch_add_explicit(&partitions, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&alloc_class[size_class(size)], 1, memory_order_relaxed);
 
     return 1; /* success */
 }
@@ -116,108 +428,179 @@ int allocate(int pid, int size)
 void remove_hole(int base)
 {
     smm_init();
-    struct hole *prev = NULL;
-    struct hole *cur = holes_head;
-    while (cur) {
-        if (cur->base == base) {
-            if (prev) prev->next = cur->next;
-            else holes_head = cur->next;
-            free(cur);
-            return;
-        }
-        prev = cur;
-        cur = cur->next;
-    }
+    pthread_mutex_lock(&smm_lock);
+    hole_take(base);
+    pthread_mutex_unlock(&smm_lock);
 }
 
+/* holes are coalesced as they are added; kept for callers of the list interface */
 void merge_holes(void)
 {
     smm_init();
-    struct hole *cur = holes_head;
-    while (cur && cur->next) {
-        struct hole *n = cur->next;
-        if (cur->base + cur->size == n->base) {
-            /* merge n into cur */
-            cur->size += n->size;
-            cur->next = n->next;
-            free(n);
-            /* continue without advancing cur to check for further merges */
-        } else {
-            cur = cur->next;
-        }
+}
+
+/* put [base, base + size) into the index joined with the holes right
+ * before and after it; returns the base of the resulting hole. smm_lock held */
+static int insert_hole_locked(int base, int size)
+{
+    int after = hole_at(base + size);
+    if (after > 0) {
+        hole_take(base + size);
+        size += after;
+    }
+    if (base > 0 && hole_end[base - 1] >= 0) {
+        int before = hole_end[base - 1];
+        size += hole_take(before);
+        base = before;
     }
+    hole_put(base, size);
+    return base;
 }
 
 void add_hole(int base, int size)
 {
     smm_init();
     if (size <= 0) return;
-    struct hole *node = (struct hole*)malloc(sizeof(struct hole));
-    if (!node) {
-        fprintf(stderr, "SMM: add_hole malloc failed\n");
+    if (base < 0 || base + size > MEM_SIZE) {
+        fprintf(stderr, "SMM: add_hole outside memory (%d words at %d)\n", size, base);
         return;
     }
-    node->base = base;
-    node->size = size;
-    node->next = NULL;
-
-    /* insert sorted by base */
-    struct hole *prev = NULL;
-    struct hole *cur = holes_head;
-    while (cur && cur->base < base) {
-        prev = cur;
-        cur = cur->next;
-    }
-    if (prev == NULL) {
-        node->next = holes_head;
-        holes_head = node;
-    } else {
-        node->next = prev->next;
-        prev->next = node;
-    }
-
-    new_hole_count++;
-    merge_holes();
+    pthread_mutex_lock(&smm_lock);
+    int merged = hole_at(insert_hole_locked(base, size)); /* reported once the lock is dropped */
+    pthread_mutex_unlock(&smm_lock);
+    if (free_hook) free_hook(merged);
 }
 
 void deallocate(int pid)
 {
     smm_init();
-    for (int i = 0; i < 256; ++i) {
-        if (alloc_table[i][0] == pid && alloc_table[i][2] > 0) {
-            int base = alloc_table[i][1];
-            int size = alloc_table[i][2];
-            /* mark table row free */
-            alloc_table[i][0] = 0;
-            alloc_table[i][1] = 0;
-            alloc_table[i][2] = 0;
-            /* add a hole */
-            add_hole(base, size);
+    _Atomic uint64_t *row = alloc_row(pid, 0);
+    /* mark table row free; the exchange lets only one caller free it */
+    uint64_t old = row ? atomic_exchange_explicit(row, 0, memory_order_acq_rel) : 0;
+    if (row_size(old) > 0) {
+        int base = row_base(old);
+        int size = row_size(old);
+        atomic_fetch_sub_explicit(&partitions, 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&alloc_class[size_class(size)], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&new_hole_count, 1, memory_order_relaxed); /* cached or not, once */
+        if (release_hook) release_hook(base, size);
+        if (size <= smm_cache_words && cache_put(base, size)) {
+            if (free_hook) free_hook(size);
             return;
         }
+        /* add a hole */
+        add_hole(base, size);
+        return;
     }
     fprintf(stderr, "SMM: deallocate called for unknown PID %d\n", pid);
 }
 
 int get_base_address(int pid)
 {
-    smm_init();
-    for (int i = 0; i < 256; ++i) {
-        if (alloc_table[i][0] == pid && alloc_table[i][2] > 0) return alloc_table[i][1];
-    }
+    uint64_t row = load_row(pid);
+    if (row_size(row) > 0) return row_base(row);
     return -1;
 }
 
 int is_allowed_address(int pid, int addr)
 {
+    uint64_t row = load_row(pid);
+    if (row_size(row) == 0) return 0; /* pid not found */
+    int base = row_base(row);
+    int size = row_size(row);
+    return addr >= base && addr < base + size;
+}
+
+/* record a sample if cycle_num reached the next sampling point */
+void smm_sample(int cycle_num)
+{
+    if (cycle_num < next_sample) return;
     smm_init();
-    for (int i = 0; i < 256; ++i) {
-        if (alloc_table[i][0] == pid && alloc_table[i][2] > 0) {
-            int base = alloc_table[i][1];
-            int size = alloc_table[i][2];
-            if (addr >= base && addr < base + size) return 1;
-            else return 0;
+    pthread_mutex_lock(&smm_lock);
+    next_sample = cycle_num - cycle_num % smm_sample_period + smm_sample_period;
+    if (table_reserve((void **)&samples, &samples_cap, nsamples, sizeof(*samples))) {
+        struct smm_sample *t = &samples[nsamples++];
+        t->cycle = cycle_num;
+        t->holes = hole_count;
+        t->free_words = free_words;
+        t->largest = hole_tree[1];
+        t->partitions = atomic_load_explicit(&partitions, memory_order_relaxed);
+        for (int k = 0; k < SMM_SIZE_CLASSES; ++k) {
+            t->alloc_class[k] = atomic_load_explicit(&alloc_class[k], memory_order_relaxed);
         }
+        if (hole_count > peak_holes) peak_holes = hole_count;
+        double frag = ext_fragmentation(hole_tree[1], free_words);
+        if (frag > peak_frag) peak_frag = frag;
     }
-    return 0; /* pid not found */
+    pthread_mutex_unlock(&smm_lock);
+}
+
+/**
+ * write the samples as CSV, one row per sample: cycle, hole count, free
+ * words, largest hole, external fragmentation, live partitions and the
+ * number of partitions in each power-of-two size class.
+ * returns 0 if the file cannot be written
+ */
+int smm_export_telemetry(const char *fname)
+{
+    FILE *out = fopen(fname, "w");
+    if (!out) {
+        fprintf(stderr, "SMM: cannot write %s\n", fname);
+        return 0;
+    }
+    pthread_mutex_lock(&smm_lock);
+    int classes = size_class(MEM_SIZE) + 1;
+    fprintf(out, "cycle,holes,free_words,largest_hole,ext_frag,partitions");
+    for (int k = 0; k < classes; ++k) fprintf(out, ",alloc_%d_%d", 1 << k, (1 << (k + 1)) - 1);
+    fprintf(out, "\n");
+    for (int i = 0; i < nsamples; ++i) {
+        struct smm_sample *t = &samples[i];
+        fprintf(out, "%d,%d,%d,%d,%.4f,%d", t->cycle, t->holes, t->free_words, t->largest,
+                ext_fragmentation(t->largest, t->free_words), t->partitions);
+        for (int k = 0; k < classes; ++k) fprintf(out, ",%d", t->alloc_class[k]);
+        fprintf(out, "\n");
+    }
+    pthread_mutex_unlock(&smm_lock);
+    fclose(out);
+    return 1;
+}
+
+/* mean and peak external fragmentation over the samples taken so far */
+void smm_fragmentation_summary(double *mean, double *peak)
+{
+    pthread_mutex_lock(&smm_lock);
+    double sum = 0.0;
+    for (int i = 0; i < nsamples; ++i) sum += ext_fragmentation(samples[i].largest, samples[i].free_words);
+    *mean = nsamples ? sum / nsamples : 0.0;
+    *peak = peak_frag;
+    pthread_mutex_unlock(&smm_lock);
+}
+
+/* free words, largest hole and hole count right now, without taking
+ * smm_lock: each is current but they may come from different moments
+ * while another thread allocates. unlike largest_hole() this leaves the
+ * thread caches alone, so watching does not change allocation */
+void smm_free_space(int *free_total, int *largest, int *holes)
+{
+    smm_init();
+    *free_total = atomic_load_explicit(&free_words, memory_order_relaxed);
+    *largest = atomic_load_explicit(&largest_free, memory_order_relaxed);
+    *holes = atomic_load_explicit(&hole_count, memory_order_relaxed);
+}
+
+void print_smm_telemetry(void)
+{
+    smm_init();
+    pthread_mutex_lock(&smm_lock);
+    printf("SMM: %d holes, %d free words, largest hole %d, external fragmentation %.3f "
+           "(%d samples, peak %d holes, peak fragmentation %.3f)\n",
+           hole_count, free_words, hole_tree[1], ext_fragmentation(hole_tree[1], free_words),
+           nsamples, peak_holes, peak_frag);
+    pthread_mutex_unlock(&smm_lock);
+}
+
+void print_smm_cache_stats(void)
+{
+    printf("SMM caches: partitions up to %d words, %ld allocations served from a thread cache, %ld flushes\n",
+           smm_cache_words, atomic_load(&cache_hits), atomic_load(&cache_flushes));
 }
@@ -11,9 +11,25 @@ void add_hole(int base, int size);
 void remove_hole(int base);
 void merge_holes(void);
 int find_hole(int size);
+int can_allocate(int size);
+int largest_hole(void);
+void smm_set_free_hook(void (*hook)(int hole_size));
+void smm_set_release_hook(void (*hook)(int base, int size));
 int get_base_address(int pid);
-int find_empty_row(void);
 int is_allowed_address(int pid, int addr);
 void print_new_hole_count(void);
 
+extern int smm_cache_words;
+void print_smm_cache_stats(void);
+
+extern int smm_telemetry_enabled;
+extern int smm_sample_period;
+extern char smm_telemetry_file[];
+
+void smm_sample(int cycle_num);
+int smm_export_telemetry(const char *fname);
+void smm_fragmentation_summary(double *mean, double *peak);
+void smm_free_space(int *free_total, int *largest, int *holes);
+void print_smm_telemetry(void);
+
 #endif
@@ -0,0 +1,139 @@
+/**
+ * smm_stress.c
+ * Multi-threaded stress test for the SMM (built on its own, see README).
+ *
+ * Every thread allocates and frees partitions of random sizes for its own
+ * range of PIDs, small enough that the per-thread caches are exercised
+ * too. Each word of memory records the PID holding it: a partition
+ * handed out over words another PID still holds is an overlap, and a
+ * partition outside memory or not matching get_base_address() is wrong.
+ * Once every thread has freed everything, the SMM must have one hole
+ * covering all of memory again, or words were lost.
+ *
+ * ./smm_stress [threads] [operations per thread]
+ * exits with 0 if no error was found
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "smm.h"
+
+#ifndef MEM_SIZE
+#define MEM_SIZE 1024
+#endif
+
+#define STRESS_PIDS 24      /* live PIDs per thread at most */
+#define STRESS_PID_STRIDE 100000 /* thread t uses PIDs from t * STRESS_PID_STRIDE */
+#define STRESS_MAX_WORDS 48
+
+static atomic_int owner[MEM_SIZE]; /* PID holding the word, -1 if free */
+static atomic_long errors = 0;
+static int threads = 4;
+static int ops_per_thread = 200000;
+
+struct held {
+    int pid;
+    int base;
+    int size;
+};
+
+static void fail(const char *what, int pid, int base, int size)
+{
+    if (atomic_fetch_add(&errors, 1) < 10) {
+        fprintf(stderr, "smm_stress: %s (PID %d, %d words at %d)\n", what, pid, size, base);
+    }
+}
+
+/* claim [base, base + size) for pid; reports words another PID holds */
+static void claim(int pid, int base, int size)
+{
+    if (base < 0 || base + size > MEM_SIZE) {
+        fail("partition outside memory", pid, base, size);
+        return;
+    }
+    for (int a = base; a < base + size; ++a) {
+        int none = -1;
+        if (!atomic_compare_exchange_strong(&owner[a], &none, pid)) fail("overlapping partitions", pid, base, size);
+    }
+}
+
+static void release(const struct held *h)
+{
+    for (int a = h->base; a < h->base + h->size; ++a) {
+        int mine = h->pid;
+        if (!atomic_compare_exchange_strong(&owner[a], &mine, -1)) fail("word taken while held", h->pid, h->base, h->size);
+    }
+    deallocate(h->pid);
+}
+
+static void *stress_thread(void *arg)
+{
+    int t = (int)(long)arg;
+    unsigned seed = 12345u + (unsigned)t * 7919u;
+    struct held held[STRESS_PIDS];
+    int n = 0, words = 0, next_pid = t * STRESS_PID_STRIDE;
+    int budget = MEM_SIZE / (2 * threads); /* leaves room for fragmentation, so allocations rarely fail */
+
+    for (int op = 0; op < ops_per_thread; ++op) {
+        if (n == STRESS_PIDS || (n > 0 && rand_r(&seed) % 2)) {
+            int i = rand_r(&seed) % n;
+            release(&held[i]);
+            words -= held[i].size;
+            held[i] = held[--n];
+            continue;
+        }
+        int size = 1 + rand_r(&seed) % STRESS_MAX_WORDS;
+        if (words + size > budget) continue;
+        int pid = next_pid++;
+        if (next_pid == (t + 1) * STRESS_PID_STRIDE) next_pid = t * STRESS_PID_STRIDE;
+        if (!allocate(pid, size)) continue; /* fragmented for now */
+        int base = get_base_address(pid);
+        if (!is_allowed_address(pid, base + size - 1) || is_allowed_address(pid, base + size)) {
+            fail("allocation table row does not match the size", pid, base, size);
+        }
+        claim(pid, base, size);
+        held[n].pid = pid;
+        held[n].base = base;
+        held[n].size = size;
+        words += size;
+        n++;
+    }
+    while (n > 0) release(&held[--n]);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) threads = atoi(argv[1]);
+    if (argc > 2) ops_per_thread = atoi(argv[2]);
+    if (threads < 1 || ops_per_thread < 0) {
+        fprintf(stderr, "usage: %s [threads] [operations per thread]\n", argv[0]);
+        return 2;
+    }
+    for (int a = 0; a < MEM_SIZE; ++a) atomic_init(&owner[a], -1);
+    smm_cache_words = STRESS_MAX_WORDS / 2;
+
+    pthread_t *tid = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    if (!tid) {
+        fprintf(stderr, "smm_stress: out of memory\n");
+        return 2;
+    }
+    for (int t = 0; t < threads; ++t) pthread_create(&tid[t], NULL, stress_thread, (void *)(long)t);
+    for (int t = 0; t < threads; ++t) pthread_join(tid[t], NULL);
+    free(tid);
+
+    int free_total = 0, largest = 0, holes = 0;
+    int whole = largest_hole(); /* flushes the thread caches back */
+    smm_free_space(&free_total, &largest, &holes);
+    if (whole != MEM_SIZE || free_total != MEM_SIZE || holes != 1) {
+        fprintf(stderr, "smm_stress: %d words free in %d holes (largest %d) after freeing everything, expected %d in 1\n",
+                free_total, holes, largest, MEM_SIZE);
+        atomic_fetch_add(&errors, 1);
+    }
+    print_smm_cache_stats();
+    long e = atomic_load(&errors);
+    printf("smm_stress: %d threads x %d operations, %ld errors\n", threads, ops_per_thread, e);
+    return e == 0 ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+/**
+ * swap.c
+ * Swapping of whole partitions to a backing file when memory runs out.
+ *
+ * When allocate() cannot find a hole, partitions of ready (not running)
+ * processes are copied to an mmap'd swap file and their memory is freed,
+ * starting at the tail of the ready queue: under round-robin the process
+ * preempted last runs last. The process due next and the one being
+ * prefetched are never evicted. A swapped process is brought back, at whatever base allocate() gives it,
+ * when the scheduler selects it; the process queued right behind the
+ * running one is prefetched so its swap-in overlaps with execution.
+ *
+ * The swap device is modelled as one channel that needs
+ * swap_cycles_per_word cycles per word; when a process is selected
+ * before its swap-in has finished, the difference is a stall. Stalls pile
+ * up until the main loop adds them to the cycle count with
+ * swap_take_stall_cycles(), and the process's quantum starts after its
+ * stall. Device time is the cycle count plus the stalls not taken yet.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "swap.h"
+#include "memory.h"
+#include "smm.h"
+#include "table.h"
+#include "cow.h"
+#include "text.h"
+#include "loopsum.h"
+
+int swap_enabled = 1;          /* set to 0 to drop programs that do not fit */
+int swap_cycles_per_word = 2;  /* simulated cost of moving one word to/from swap */
+
+struct swap_slot {
+    long offset;   /* start in the swap file (words) */
+    int cap;       /* words reserved at offset */
+    int size;      /* words currently stored */
+    int ready_at;  /* cycle at which the last swap-in completes */
+};
+
+static struct swap_slot *slots = NULL; /* by PID */
+static int slots_cap = 0;
+
+static int swap_fd = -1;
+static int (*swap_area)[2] = NULL;
+static long swap_words = 0;  /* size of the mapping */
+static long swap_top = 0;    /* first unreserved word */
+
+static int device_free_at = 0;
+static int prefetching = -1; /* PID whose swap-in was started early, until it runs */
+
+static long swap_outs = 0, swap_ins = 0;
+static long words_out = 0, words_in = 0;
+static long stall_cycles = 0;  /* total, for the statistics */
+static int stall_pending = 0;  /* not yet added to the cycle count */
+
+/* make sure the swap file can hold `words` words, growing the mapping if needed */
+static int swap_grow(long words)
+{
+    if (words <= swap_words) return 1;
+
+    if (swap_fd < 0) {
+        char path[] = "/tmp/os_swapXXXXXX";
+        swap_fd = mkstemp(path);
+        if (swap_fd < 0) {
+            perror("swap: mkstemp");
+            return 0;
+        }
+        unlink(path); /* the file goes away with the simulator */
+    }
+
+    long want = swap_words ? swap_words : 1024;
+    while (want < words) want *= 2;
+    if (ftruncate(swap_fd, want * (long)sizeof(swap_area[0])) != 0) {
+        perror("swap: ftruncate");
+        return 0;
+    }
+    if (swap_area) munmap(swap_area, swap_words * sizeof(swap_area[0]));
+    swap_area = mmap(NULL, want * sizeof(swap_area[0]), PROT_READ | PROT_WRITE, MAP_SHARED, swap_fd, 0);
+    if (swap_area == MAP_FAILED) {
+        perror("swap: mmap");
+        swap_area = NULL;
+        swap_words = 0;
+        return 0;
+    }
+    swap_words = want;
+    return 1;
+}
+
+/* charge one transfer of `size` words to the swap device, return its completion cycle */
+static int device_op(int size, int cycle_num)
+{
+    int now = cycle_num + stall_pending;
+    int start = now > device_free_at ? now : device_free_at;
+    device_free_at = start + size * swap_cycles_per_word;
+    return device_free_at;
+}
+
+static int swap_out(PCB *p, int cycle_num)
+{
+    int pid = p->pid;
+    int base = get_base_address(pid);
+    int size = p->size - text_words(pid); /* shared text stays where it is */
+    if (base < 0 || size <= 0) return 0;
+
+    if (!table_reserve((void **)&slots, &slots_cap, pid, sizeof(*slots))) return 0;
+    struct swap_slot *s = &slots[pid];
+    if (s->cap < size) {
+        if (!swap_grow(swap_top + size)) return 0;
+        s->offset = swap_top;
+        s->cap = size;
+        swap_top += size;
+    }
+
+    mem_copy_out(base, swap_area + s->offset, size);
+    deallocate(pid);
+    s->size = size;
+    p->flags |= PCB_SWAPPED;
+
+    device_op(size, cycle_num);
+    swap_outs++;
+    words_out += size;
+    return 1;
+}
+
+/**
+ * evict resident processes (never the running one or exclude_pid) until a
+ * hole of `size` words exists. returns 1 if there is room afterwards
+ */
+int swap_make_room(int size, int exclude_pid, int cycle_num)
+{
+    if (can_allocate(size)) return 1;
+    if (!swap_enabled) return 0;
+
+    /* the head runs now (or is being switched in), the one behind it next */
+    PCB *first[2] = { NULL, NULL };
+    scheduler_ready_pcbs(first, 2);
+    int running = get_current_pid();
+
+    for (PCB *p = scheduler_ready_prev(NULL); p && !can_allocate(size); ) {
+        PCB *prev = scheduler_ready_prev(p);
+        int pid = p->pid;
+        if (p != first[0] && p != first[1] && pid != running && pid != exclude_pid && pid != prefetching &&
+            !(p->flags & PCB_SWAPPED) && get_base_address(pid) >= 0 &&
+            cow_sharers(pid) == 0) { /* children map a shared partition in place */
+            swap_out(p, cycle_num);
+        }
+        p = prev;
+    }
+
+    return can_allocate(size);
+}
+
+/* copy a swapped process back into a fresh partition; returns 0 if it does not fit */
+static int swap_bring_in(PCB *p, int cycle_num)
+{
+    int pid = p->pid;
+    struct swap_slot *s = &slots[pid];
+    if (!swap_make_room(s->size, pid, cycle_num) || !allocate(pid, s->size)) return 0;
+
+    int base = get_base_address(pid);
+    mem_copy_in(base, swap_area + s->offset, s->size);
+    p->base = base - text_words(pid);
+    text_rebase(pid, p->base);
+    /* its loop summaries were dropped with the old partition */
+    if (loopsum_enabled) loopsum_analyze(p->base, text_words(pid), swap_area + s->offset, s->size);
+    p->flags &= ~PCB_SWAPPED;
+
+    s->ready_at = device_op(s->size, cycle_num);
+    swap_ins++;
+    words_in += s->size;
+    return 1;
+}
+
+/**
+ * make p resident before it runs. returns the number of cycles it has to
+ * wait for its swap-in, or -1 if it cannot be brought back at all
+ */
+int swap_in(PCB *p, int cycle_num)
+{
+    if (p->pid == prefetching) prefetching = -1;
+    if (p->flags & PCB_SWAPPED) {
+        if (!swap_bring_in(p, cycle_num)) return -1;
+    }
+    if (p->pid >= slots_cap) return 0; /* never swapped */
+    int stall = slots[p->pid].ready_at - (cycle_num + stall_pending);
+    slots[p->pid].ready_at = 0;
+    if (stall <= 0) return 0;
+    stall_cycles += stall;
+    stall_pending += stall;
+    return stall;
+}
+
+/* start bringing p back early so the transfer overlaps the running process */
+void swap_prefetch(PCB *p, int cycle_num)
+{
+    if ((p->flags & PCB_SWAPPED) && swap_bring_in(p, cycle_num)) prefetching = p->pid;
+}
+
+/* forget swap state of an exiting process; its file space is reused by the next owner of the PID */
+void swap_release(int pid)
+{
+    if (pid == prefetching) prefetching = -1;
+    if (pid < 0 || pid >= slots_cap) return;
+    slots[pid].size = 0;
+    slots[pid].ready_at = 0;
+}
+
+/**
+ * give a forked simulator its own swap file: the mapping is shared with
+ * the parent, so partitions swapped out before the fork are copied to a
+ * new file. returns 0 if the copy cannot be made
+ */
+int swap_detach(void)
+{
+    if (swap_fd < 0) return 1; /* nothing swapped yet; the first swap-out makes a fresh file */
+    int (*old_area)[2] = swap_area;
+    long old_words = swap_words;
+    int old_fd = swap_fd;
+
+    swap_fd = -1;
+    swap_area = NULL;
+    swap_words = 0;
+    if (!swap_grow(old_words)) {
+        swap_fd = old_fd;
+        swap_area = old_area;
+        swap_words = old_words;
+        return 0;
+    }
+    memcpy(swap_area, old_area, swap_top * sizeof(swap_area[0]));
+    munmap(old_area, old_words * sizeof(swap_area[0]));
+    close(old_fd);
+    return 1;
+}
+
+/* cycles processes have waited for their swap-in so far */
+long swap_stall_cycles(void)
+{
+    return stall_cycles;
+}
+
+/* stall cycles since the last call, to be added to the cycle count */
+int swap_take_stall_cycles(void)
+{
+    int c = stall_pending;
+    stall_pending = 0;
+    return c;
+}
+
+void print_swap_stats(void)
+{
+    printf("Swap: %ld swap-outs (%ld words), %ld swap-ins (%ld words), %ld stall cycles\n",
+           swap_outs, words_out, swap_ins, words_in, stall_cycles);
+}
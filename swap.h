@@ -0,0 +1,22 @@
+/**
+ * swap.h
+ * Swapping of whole partitions to a backing file when memory runs out.
+ */
+#ifndef SWAP_H
+#define SWAP_H
+
+#include "scheduler.h"
+
+extern int swap_enabled;
+extern int swap_cycles_per_word;
+
+int swap_make_room(int size, int exclude_pid, int cycle_num);
+int swap_in(PCB *p, int cycle_num);
+void swap_prefetch(PCB *p, int cycle_num);
+void swap_release(int pid);
+int swap_detach(void);
+long swap_stall_cycles(void);
+int swap_take_stall_cycles(void);
+void print_swap_stats(void);
+
+#endif
@@ -0,0 +1,243 @@
+/**
+ * sweep.c
+ * Parameter sweep over forked copies of the loaded machine.
+ *
+ * The caller loads the workload once; sweep_run() then fork()s one
+ * worker per configuration, so every worker starts from the same loaded
+ * memory, SMM and scheduler state, shared copy-on-write by the kernel
+ * instead of reloaded. A configuration is a time quantum; memory policies
+ * are not swept, since the programs were admitted before the fork and a
+ * worker would only see them act on later arrivals. At most sweep_workers
+ * run at once. Each worker runs the simulation with its output
+ * discarded and sends back cycles, exits, faults, mean turnaround (exit
+ * cycle minus creation cycle), throughput and external fragmentation.
+ * The results are printed as one table and written to sweep_file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "sweep.h"
+#include "scheduler.h"
+#include "smm.h"
+#include "swap.h"
+#include "monitor.h"
+
+#define SWEEP_SAMPLE_PERIOD 10 /* cycles between fragmentation samples */
+
+int sweep_workers = 0;                   /* parallel workers; 0: one per online CPU */
+char sweep_quanta[] = "1,2,5,10,20,50";  /* default --sweep quanta */
+char sweep_file[] = "sweep.csv";
+
+struct sweep_config {
+    int quantum;
+};
+
+struct sweep_result {
+    int ok;
+    int cycles;
+    int exited;
+    int faulted;
+    double turnaround;  /* mean over processes that left */
+    double frag_mean;
+    double frag_peak;
+};
+
+struct worker {
+    pid_t pid;
+    int fd;             /* read end of the result pipe */
+};
+
+/* filled in by the exit hook inside a worker */
+static int exited = 0, faulted = 0;
+static long turnaround_total = 0;
+
+static void count_exit(PCB *p, int was_faulted, int cycle_num)
+{
+    if (was_faulted) faulted++;
+    else exited++;
+    turnaround_total += cycle_num - p->arrival;
+}
+
+static double ms_between(struct timespec a, struct timespec b)
+{
+    return (b.tv_sec - a.tv_sec) * 1000.0 + (b.tv_nsec - a.tv_nsec) / 1e6;
+}
+
+/* in the forked worker: apply cfg, simulate, report through fd */
+static void run_worker(const struct sweep_config *cfg, int (*simulate)(void), int fd)
+{
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(null);
+    }
+
+    struct sweep_result r;
+    memset(&r, 0, sizeof(r));
+    r.ok = swap_detach(); /* the swap file is a shared mapping */
+    if (r.ok) {
+        time_quantum = cfg->quantum;
+        smm_telemetry_enabled = 1;
+        smm_sample_period = SWEEP_SAMPLE_PERIOD;
+        scheduler_set_exit_hook(count_exit);
+        monitor_enabled = 0; /* the stats segment belongs to the parent's name */
+
+        r.cycles = simulate();
+        r.exited = exited;
+        r.faulted = faulted;
+        r.turnaround = exited + faulted ? (double)turnaround_total / (exited + faulted) : 0.0;
+        smm_fragmentation_summary(&r.frag_mean, &r.frag_peak);
+    }
+    ssize_t n = write(fd, &r, sizeof(r)); /* smaller than PIPE_BUF: one atomic write */
+    _exit(n == (ssize_t)sizeof(r) ? 0 : 1);
+}
+
+/**
+ * wait for one child to finish and store its result if it was a worker.
+ * returns 1 if a worker was reaped, 0 for any other child or an
+ * interrupted wait, -1 if there are no children left to wait for
+ */
+static int reap_one(struct worker *w, int nconfigs, struct sweep_result *results)
+{
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0) return errno == EINTR ? 0 : -1;
+    for (int i = 0; i < nconfigs; ++i) {
+        if (w[i].pid != pid) continue;
+        if (read(w[i].fd, &results[i], sizeof(results[i])) != (ssize_t)sizeof(results[i])) results[i].ok = 0;
+        close(w[i].fd);
+        w[i].pid = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/* reap until a worker finishes; returns the number still running */
+static int reap_worker(struct worker *w, int nconfigs, struct sweep_result *results, int running)
+{
+    for (;;) {
+        int r = reap_one(w, nconfigs, results);
+        if (r > 0) return running - 1;
+        if (r == 0) continue;
+        /* workers we never saw exit: report them failed and drop their pipes */
+        perror("sweep: wait");
+        for (int i = 0; i < nconfigs; ++i) {
+            if (w[i].pid <= 0) continue;
+            results[i].ok = 0;
+            close(w[i].fd);
+            w[i].pid = 0;
+        }
+        return 0;
+    }
+}
+
+static void print_results(const struct sweep_config *cfg, const struct sweep_result *res, int n)
+{
+    printf("%8s %8s %7s %8s %11s %11s %10s %10s\n", "quantum",
+           "cycles", "exited", "faulted", "turnaround", "throughput", "frag_mean", "frag_peak");
+    for (int i = 0; i < n; ++i) {
+        if (!res[i].ok) {
+            printf("%8d   (worker failed)\n", cfg[i].quantum);
+            continue;
+        }
+        double throughput = res[i].cycles ? 1000.0 * res[i].exited / res[i].cycles : 0.0;
+        printf("%8d %8d %7d %8d %11.1f %11.3f %10.3f %10.3f\n",
+               cfg[i].quantum, res[i].cycles,
+               res[i].exited, res[i].faulted, res[i].turnaround, throughput, res[i].frag_mean, res[i].frag_peak);
+    }
+
+    FILE *out = fopen(sweep_file, "w");
+    if (!out) {
+        fprintf(stderr, "sweep: cannot write %s\n", sweep_file);
+        return;
+    }
+    fprintf(out, "quantum,cycles,exited,faulted,turnaround,throughput_per_kcycle,frag_mean,frag_peak\n");
+    for (int i = 0; i < n; ++i) {
+        if (!res[i].ok) continue;
+        double throughput = res[i].cycles ? 1000.0 * res[i].exited / res[i].cycles : 0.0;
+        fprintf(out, "%d,%d,%d,%d,%.2f,%.4f,%.4f,%.4f\n",
+                cfg[i].quantum, res[i].cycles,
+                res[i].exited, res[i].faulted, res[i].turnaround, throughput, res[i].frag_mean, res[i].frag_peak);
+    }
+    fclose(out);
+    printf("Sweep results written to %s\n", sweep_file);
+}
+
+/**
+ * run simulate() once per time quantum in the comma separated list, each
+ * in a forked copy of the
+ * current (loaded, not yet run) machine. simulate returns the cycles the
+ * run took. returns 0 if the sweep could not be run
+ */
+int sweep_run(const char *quanta, int (*simulate)(void))
+{
+    int max = 1;
+    for (const char *c = quanta; *c; ++c) max += *c == ',';
+    struct sweep_config *cfg = calloc(max, sizeof(*cfg));
+    struct sweep_result *res = calloc(max, sizeof(*res));
+    struct worker *w = calloc(max, sizeof(*w));
+    if (!cfg || !res || !w) {
+        fprintf(stderr, "sweep: out of memory\n");
+        free(cfg);
+        free(res);
+        free(w);
+        return 0;
+    }
+
+    int n = 0;
+    const char *c = quanta;
+    while (*c) {
+        char *end;
+        long q = strtol(c, &end, 10);
+        if (end == c) break;
+        if (q > 0) cfg[n++].quantum = (int)q;
+        c = *end == ',' ? end + 1 : end;
+    }
+
+    int parallel = sweep_workers > 0 ? sweep_workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (parallel < 1) parallel = 1;
+    printf("Sweep: %d configurations, up to %d workers\n", n, parallel);
+    fflush(stdout); /* or the workers would print the buffered output again */
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int running = 0;
+    for (int i = 0; i < n; ++i) {
+        if (running == parallel) running = reap_worker(w, n, res, running);
+        int fds[2];
+        if (pipe(fds) < 0) {
+            perror("sweep: pipe");
+            continue;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            run_worker(&cfg[i], simulate, fds[1]);
+        }
+        close(fds[1]);
+        if (pid < 0) {
+            perror("sweep: fork");
+            close(fds[0]);
+            continue;
+        }
+        w[i].pid = pid;
+        w[i].fd = fds[0];
+        running++;
+    }
+    while (running > 0) running = reap_worker(w, n, res, running);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("Sweep finished in %.3f ms\n", ms_between(start, end));
+    print_results(cfg, res, n);
+    free(cfg);
+    free(res);
+    free(w);
+    return 1;
+}
@@ -0,0 +1,14 @@
+/**
+ * sweep.h
+ * Parameter sweep over forked copies of the loaded machine.
+ */
+#ifndef SWEEP_H
+#define SWEEP_H
+
+extern int sweep_workers;
+extern char sweep_quanta[];
+extern char sweep_file[];
+
+int sweep_run(const char *quanta, int (*simulate)(void));
+
+#endif
@@ -0,0 +1,32 @@
+/**
+ * table.c
+ * Growable arrays indexed by a dense integer key such as a PID.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "table.h"
+
+/**
+ * make sure *data (currently *cap elements of elem_size bytes) has a slot
+ * at `index`, doubling its capacity as needed; new slots are zeroed.
+ * returns 0 if index is negative or memory runs out
+ */
+int table_reserve(void **data, int *cap, int index, size_t elem_size)
+{
+    if (index < 0) return 0;
+    if (index < *cap) return 1;
+
+    int ncap = *cap ? *cap : 64;
+    while (ncap <= index) ncap *= 2;
+    char *grown = (char *)realloc(*data, (size_t)ncap * elem_size);
+    if (!grown) {
+        fprintf(stderr, "table_reserve: out of memory for %d entries\n", ncap);
+        return 0;
+    }
+    memset(grown + (size_t)*cap * elem_size, 0, (size_t)(ncap - *cap) * elem_size);
+    *data = grown;
+    *cap = ncap;
+    return 1;
+}
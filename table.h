@@ -0,0 +1,12 @@
+/**
+ * table.h
+ * Growable arrays indexed by a dense integer key such as a PID.
+ */
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stddef.h>
+
+int table_reserve(void **data, int *cap, int index, size_t elem_size);
+
+#endif
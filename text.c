@@ -0,0 +1,212 @@
+/**
+ * text.c
+ * Shared read-only text segments for programs loaded more than once.
+ *
+ * A program's instructions are loaded into a segment keyed by a hash of
+ * their contents; every process running identical text maps the same
+ * segment and only gets a private partition for the rest of its logical
+ * space (its data). The process's base is set `count` words below its
+ * private partition, so logical addresses past the text land in the
+ * partition unchanged and only addresses inside the text are translated
+ * here. Text is read-only: a write to it is refused and faults like any
+ * other illegal access.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "text.h"
+#include "smm.h"
+#include "memory.h"
+#include "swap.h"
+#include "loopsum.h"
+#include "table.h"
+
+#define TEXT_BUCKETS 256
+
+int text_share_enabled = 0; /* set to 1 to share identical text; writes into it then fault */
+int text_active = 0;        /* number of processes mapping a segment; 0 keeps memory.c on the plain path */
+
+struct text_segment {
+    unsigned hash;
+    int base;
+    int count;
+    int refs;            /* 0: slot is free */
+    int next;            /* next segment in the same bucket, -1 at the end */
+    int (*words)[2];     /* copy of the text, to rule out hash collisions */
+};
+
+struct text_map {
+    int seg;             /* segment index + 1, 0 if the process maps none */
+    int vbase;           /* the process's base: its text is at [vbase, vbase + count) */
+};
+
+static struct text_segment *segs = NULL;
+static struct text_map *maps = NULL;     /* by PID */
+static int segs_cap = 0, maps_cap = 0, segs_used = 0;
+static int bucket[TEXT_BUCKETS];
+static int buckets_ready = 0;
+
+static long loads = 0, shares = 0, words_saved = 0;
+
+/* FNV-1a over the opcode/argument pairs */
+static unsigned text_hash(int (*text)[2], int count)
+{
+    unsigned h = 2166136261u;
+    const unsigned char *p = (const unsigned char *)text;
+    for (size_t i = 0; i < (size_t)count * sizeof(text[0]); ++i) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int find_segment(unsigned hash, int (*text)[2], int count)
+{
+    for (int s = bucket[hash % TEXT_BUCKETS]; s >= 0; s = segs[s].next) {
+        if (segs[s].hash == hash && segs[s].count == count &&
+            memcmp(segs[s].words, text, count * sizeof(text[0])) == 0) return s;
+    }
+    return -1;
+}
+
+static struct text_map *map_of(int pid)
+{
+    if (pid < 0 || pid >= maps_cap || maps[pid].seg == 0) return NULL;
+    return &maps[pid];
+}
+
+/**
+ * take a reference on the segment holding this text, loading it into a
+ * hole of its own the first time. returns the segment, or -1 if there is
+ * no room for it right now
+ */
+int text_share(int (*text)[2], int count, int cycle_num)
+{
+    if (!buckets_ready) {
+        for (int b = 0; b < TEXT_BUCKETS; ++b) bucket[b] = -1;
+        buckets_ready = 1;
+    }
+    if (count <= 0) return -1;
+
+    unsigned hash = text_hash(text, count);
+    int s = find_segment(hash, text, count);
+    if (s >= 0) {
+        segs[s].refs++;
+        shares++;
+        words_saved += count;
+        return s;
+    }
+
+    swap_make_room(count, -1, cycle_num);
+    int base = find_hole(count);
+    if (base < 0) return -1;
+
+    for (s = 0; s < segs_used && segs[s].refs > 0; ++s) ;
+    int (*words)[2] = malloc(count * sizeof(text[0]));
+    if (!words || !table_reserve((void **)&segs, &segs_cap, s, sizeof(*segs))) {
+        fprintf(stderr, "text_share: out of memory\n");
+        free(words);
+        add_hole(base, count);
+        return -1;
+    }
+    if (s == segs_used) segs_used++;
+
+    memcpy(words, text, count * sizeof(text[0]));
+    mem_copy_in(base, text, count);
+    loopsum_analyze(base, 0, text, count);
+
+    segs[s].hash = hash;
+    segs[s].base = base;
+    segs[s].count = count;
+    segs[s].refs = 1;
+    segs[s].words = words;
+    segs[s].next = bucket[hash % TEXT_BUCKETS];
+    bucket[hash % TEXT_BUCKETS] = s;
+    loads++;
+    return s;
+}
+
+/* drop a reference taken by text_share(); the last one frees the segment */
+void text_unshare(int seg)
+{
+    if (seg < 0 || seg >= segs_used || segs[seg].refs <= 0) return;
+    if (--segs[seg].refs > 0) return;
+
+    int *link = &bucket[segs[seg].hash % TEXT_BUCKETS];
+    while (*link != seg) link = &segs[*link].next;
+    *link = segs[seg].next;
+
+    loopsum_forget(segs[seg].base, segs[seg].count);
+    add_hole(segs[seg].base, segs[seg].count);
+    free(segs[seg].words);
+    segs[seg].words = NULL;
+}
+
+/* pid runs the text of seg (taking over the caller's reference) with its base at vbase */
+void text_bind(int pid, int seg, int vbase)
+{
+    if (!table_reserve((void **)&maps, &maps_cap, pid, sizeof(*maps))) {
+        text_unshare(seg);
+        return;
+    }
+    maps[pid].seg = seg + 1;
+    maps[pid].vbase = vbase;
+    text_active++;
+}
+
+/* a spawned child runs its parent's text from the same base */
+void text_fork(int parent, int child)
+{
+    struct text_map *m = map_of(parent);
+    if (!m) return;
+    int seg = m->seg - 1;
+    int vbase = m->vbase;
+    segs[seg].refs++;
+    text_bind(child, seg, vbase);
+}
+
+/* pid's private partition moved (swap-in); its base moves with it */
+void text_rebase(int pid, int vbase)
+{
+    struct text_map *m = map_of(pid);
+    if (m) m->vbase = vbase;
+}
+
+/**
+ * physical address of addr inside pid's shared text. returns -1 if pid
+ * maps no text or addr is outside it, -2 for a write into the text
+ */
+int text_translate(int pid, int addr, int write)
+{
+    struct text_map *m = map_of(pid);
+    if (!m) return -1;
+    struct text_segment *s = &segs[m->seg - 1];
+    int off = addr - m->vbase;
+    if (off < 0 || off >= s->count) return -1;
+    if (write) return -2;
+    return s->base + off;
+}
+
+/* number of logical words of pid that live in a shared segment */
+int text_words(int pid)
+{
+    struct text_map *m = map_of(pid);
+    return m ? segs[m->seg - 1].count : 0;
+}
+
+/* pid is gone: unmap its text */
+void text_release(int pid)
+{
+    struct text_map *m = map_of(pid);
+    if (!m) return;
+    int seg = m->seg - 1;
+    m->seg = 0;
+    text_active--;
+    text_unshare(seg);
+}
+
+void print_text_stats(void)
+{
+    printf("Text: %ld segments loaded, %ld shared loads (%ld words not duplicated)\n", loads, shares, words_saved);
+}
@@ -0,0 +1,21 @@
+/**
+ * text.h
+ * Shared read-only text segments for programs loaded more than once.
+ */
+#ifndef TEXT_H
+#define TEXT_H
+
+extern int text_share_enabled;
+extern int text_active;
+
+int text_share(int (*text)[2], int count, int cycle_num);
+void text_unshare(int seg);
+void text_bind(int pid, int seg, int vbase);
+void text_fork(int parent, int child);
+void text_rebase(int pid, int vbase);
+int text_translate(int pid, int addr, int write);
+int text_words(int pid);
+void text_release(int pid);
+void print_text_stats(void);
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * timing.c
+ * Optional cycle-cost model with a simulated set-associative cache.
+ *
+ * With timing_enabled, every instruction is charged opcode_cost[op] plus
+ * the latency of its memory accesses (the fetch, and the data access of
+ * loads, stores and stack operations) instead of a flat single cycle, and
+ * every context switch costs context_switch_cycles. Accesses go through a
+ * cache_sets x cache_ways cache of cache_line_words-word lines with LRU
+ * replacement: a hit costs cache_hit_cycles, a miss mem_latency_cycles.
+ * Only tags are kept; the data always comes from physical memory.
+ * Costs pile up until the main loop takes them with timing_take_cycles().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "timing.h"
+#include "scheduler.h"
+#include "table.h"
+
+int timing_enabled = 0; /* set to 1 to charge the costs below instead of 1 cycle/instruction */
+
+/* exit, load_const, move_from_mbr, move_from_mar, move_to_mbr, move_to_mar,
+ * load_at_addr, write_at_addr, add, multiply, and, or, ifgo, sleep, spawn,
+ * add_imm, dbnz, load_from, store_to, load_idx, store_idx, push, pop, call, ret */
+int opcode_cost[TIMING_OPCODES] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 4, 1, 1, 2, 1, 20,
+                                   1, 2, 1, 1, 1, 1, 1, 1, 2, 2};
+int cache_hit_cycles = 0;
+int mem_latency_cycles = 20;
+int context_switch_cycles = 50;
+int cache_sets = 16;
+int cache_ways = 4;
+int cache_line_words = 4;
+
+struct cache_line {
+    int tag;   /* line number (addr / cache_line_words), -1 if empty */
+    long used; /* last access, for LRU */
+};
+
+static struct cache_line *cache = NULL;
+static long access_clock = 0;
+static int pending = 0;
+
+/* per-PID counters */
+static long *hits = NULL, *misses = NULL;
+static int hits_cap = 0, misses_cap = 0;
+static long switches = 0;
+
+static int cache_init(void)
+{
+    if (cache) return 1;
+    cache = (struct cache_line *)malloc(cache_sets * cache_ways * sizeof(struct cache_line));
+    if (!cache) {
+        fprintf(stderr, "timing: cannot allocate cache\n");
+        timing_enabled = 0;
+        return 0;
+    }
+    for (int i = 0; i < cache_sets * cache_ways; ++i) {
+        cache[i].tag = -1;
+        cache[i].used = 0;
+    }
+    return 1;
+}
+
+/* look addr up in the cache, fill on miss; returns 1 on a hit */
+static int cache_lookup(int addr)
+{
+    int tag = addr / cache_line_words;
+    struct cache_line *set = &cache[(tag % cache_sets) * cache_ways];
+    struct cache_line *victim = &set[0];
+    access_clock++;
+    for (int w = 0; w < cache_ways; ++w) {
+        if (set[w].tag == tag) {
+            set[w].used = access_clock;
+            return 1;
+        }
+        if (set[w].used < victim->used) victim = &set[w];
+    }
+    victim->tag = tag;
+    victim->used = access_clock;
+    return 0;
+}
+
+/* charge one memory access to physical address addr made by pid */
+void timing_access(int pid, int addr)
+{
+    if (!cache_init() || addr < 0) return;
+    int hit = cache_lookup(addr);
+    if (table_reserve((void **)&hits, &hits_cap, pid, sizeof(long)) &&
+        table_reserve((void **)&misses, &misses_cap, pid, sizeof(long))) {
+        if (hit) hits[pid]++;
+        else misses[pid]++;
+    }
+    pending += hit ? cache_hit_cycles : mem_latency_cycles;
+}
+
+void timing_instruction(int op)
+{
+    pending += (op >= 0 && op < TIMING_OPCODES) ? opcode_cost[op] : 1;
+}
+
+void timing_context_switch(void)
+{
+    switches++;
+    pending += context_switch_cycles;
+}
+
+/* cycles charged since the last call, at least 1 so time always advances */
+int timing_take_cycles(void)
+{
+    int c = pending > 0 ? pending : 1;
+    pending = 0;
+    return c;
+}
+
+/* cycles charged but not yet taken (e.g. a context switch) */
+int timing_pending_cycles(void)
+{
+    return pending;
+}
+
+/**
+ * cost of one pass over the `len` instructions in body, assuming their
+ * fetches hit in the cache (a loop that is being repeated)
+ */
+int timing_block_cost(int (*body)[2], int len)
+{
+    int cost = 0;
+    for (int i = 0; i < len; ++i) {
+        int op = body[i][0];
+        cost += ((op >= 0 && op < TIMING_OPCODES) ? opcode_cost[op] : 1) + cache_hit_cycles;
+    }
+    return cost;
+}
+
+/* count fetches that were skipped over (e.g. by loopsum) as hits */
+void timing_credit_hits(int pid, long count)
+{
+    if (table_reserve((void **)&hits, &hits_cap, pid, sizeof(long))) hits[pid] += count;
+}
+
+void print_timing_stats(int cycles)
+{
+    printf("Timing: %d cycles, %ld context switches (%d cycles each)\n",
+           cycles, switches, context_switch_cycles);
+    printf("Cache: %d sets x %d ways x %d words, hit %d / miss %d cycles\n",
+           cache_sets, cache_ways, cache_line_words, cache_hit_cycles, mem_latency_cycles);
+    for (int pid = 0; pid < hits_cap || pid < misses_cap; ++pid) {
+        long h = pid < hits_cap ? hits[pid] : 0;
+        long m = pid < misses_cap ? misses[pid] : 0;
+        long total = h + m;
+        if (total == 0) continue;
+        printf("  PID %d: %ld hits, %ld misses (%.1f%% hit rate)\n",
+               pid, h, m, 100.0 * h / total);
+    }
+}
@@ -0,0 +1,28 @@
+/**
+ * timing.h
+ * Optional cycle-cost model with a simulated set-associative cache.
+ */
+#ifndef TIMING_H
+#define TIMING_H
+
+#define TIMING_OPCODES 25
+
+extern int timing_enabled;
+extern int opcode_cost[TIMING_OPCODES];
+extern int cache_hit_cycles;
+extern int mem_latency_cycles;
+extern int context_switch_cycles;
+extern int cache_sets;
+extern int cache_ways;
+extern int cache_line_words;
+
+void timing_access(int pid, int addr);
+void timing_instruction(int op);
+void timing_context_switch(void);
+int timing_take_cycles(void);
+int timing_pending_cycles(void);
+int timing_block_cost(int (*body)[2], int len);
+void timing_credit_hits(int pid, long count);
+void print_timing_stats(int cycles);
+
+#endif
@@ -0,0 +1,266 @@
+/**
+ * verify.c
+ * Load-time verifier that proves a program never leaves its partition.
+ *
+ * verify_program() runs an abstract interpretation of the program text
+ * over intervals for AC, MAR, MBR and SP, following every branch
+ * (ifgo/dbnz taken and not taken, call targets) to a fixpoint, widening a
+ * register to the full int range once its interval keeps growing at a
+ * join. A program is proven when every reachable instruction is fetched
+ * from inside its text, every load stays inside [0, size) and every store
+ * inside [count, size) (never into the text, so the instructions the
+ * verifier read are the ones that run). Values loaded from memory and
+ * spawn results are unknown; ret takes its target from memory, so a
+ * reachable ret leaves the program unproven. Proven processes get
+ * PCB_VERIFIED and the CPU skips the permission checks of mem_read()/
+ * mem_write() for them; all others keep the checked path.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "verify.h"
+
+#define VERIFY_WIDEN_AFTER 3 /* joins at one PC before growing bounds are widened */
+
+int verify_enabled = 1; /* set to 0 to run every process on the checked path */
+
+static int programs_checked = 0, programs_proven = 0;
+
+typedef struct interval {
+    long long lo, hi;
+} interval;
+
+enum { R_AC, R_MAR, R_MBR, R_SP, NREGS };
+
+struct state {
+    int reached;
+    int joins;
+    interval r[NREGS];
+};
+
+static const interval top = { INT_MIN, INT_MAX };
+
+static interval exact(long long v)
+{
+    interval i = { v, v };
+    return i;
+}
+
+/* the CPU computes in int: a result that may wrap can be anything */
+static interval clamp(long long lo, long long hi)
+{
+    if (lo < INT_MIN || hi > INT_MAX) return top;
+    interval i = { lo, hi };
+    return i;
+}
+
+static interval iv_add(interval a, interval b)
+{
+    return clamp(a.lo + b.lo, a.hi + b.hi);
+}
+
+static interval iv_mul(interval a, interval b)
+{
+    long long p[4] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+    long long lo = p[0], hi = p[0];
+    for (int i = 1; i < 4; ++i) {
+        if (p[i] < lo) lo = p[i];
+        if (p[i] > hi) hi = p[i];
+    }
+    return clamp(lo, hi);
+}
+
+static int inside(interval a, long long lo, long long hi)
+{
+    return a.lo >= lo && a.hi < hi;
+}
+
+/* AC after a branch on AC != 0 was taken: drop a zero bound */
+static interval nonzero(interval a)
+{
+    if (a.lo == 0) a.lo = 1;
+    else if (a.hi == 0) a.hi = -1;
+    return a;
+}
+
+static int may_be_zero(interval a) { return a.lo <= 0 && a.hi >= 0; }
+static int may_be_nonzero(interval a) { return a.lo != 0 || a.hi != 0; }
+
+/* merge s into the state at pc; returns 1 if it changed */
+static int join(struct state *st, int pc, const struct state *s)
+{
+    struct state *d = &st[pc];
+    if (!d->reached) {
+        *d = *s;
+        d->reached = 1;
+        d->joins = 0;
+        return 1;
+    }
+    int changed = 0, widen = ++d->joins > VERIFY_WIDEN_AFTER;
+    for (int i = 0; i < NREGS; ++i) {
+        if (s->r[i].lo < d->r[i].lo) {
+            d->r[i].lo = widen ? INT_MIN : s->r[i].lo;
+            changed = 1;
+        }
+        if (s->r[i].hi > d->r[i].hi) {
+            d->r[i].hi = widen ? INT_MAX : s->r[i].hi;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/**
+ * apply the instruction at pc to s. returns the number of successors
+ * written to next/next_pc (0 for exit), or -1 if the instruction may
+ * leave the partition or the text
+ */
+static int step(int (*text)[2], int count, int size, int pc, const struct state *s,
+                struct state next[2], int next_pc[2])
+{
+    int op = text[pc][0];
+    long long arg = text[pc][1];
+    struct state n = *s;
+    interval a;
+
+    switch (op) {
+        case 0: return 0;
+        case 1: n.r[R_AC] = exact(arg); break;
+        case 2: n.r[R_AC] = s->r[R_MBR]; break;
+        case 3: n.r[R_AC] = s->r[R_MAR]; break;
+        case 4: n.r[R_MBR] = s->r[R_AC]; break;
+        case 5: n.r[R_MAR] = s->r[R_AC]; break;
+        case 6:
+            if (!inside(s->r[R_MAR], 0, size)) return -1;
+            n.r[R_MBR] = top;
+            break;
+        case 7:
+            if (!inside(s->r[R_MAR], count, size)) return -1;
+            break;
+        case 8: n.r[R_AC] = iv_add(s->r[R_AC], s->r[R_MBR]); break;
+        case 9: n.r[R_AC] = iv_mul(s->r[R_AC], s->r[R_MBR]); break;
+        case 10:
+        case 11: n.r[R_AC].lo = 0; n.r[R_AC].hi = 1; break;
+        case 12:
+        case 16: {
+            int k = 0;
+            if (op == 16) n.r[R_AC] = iv_add(s->r[R_AC], exact(-1));
+            a = n.r[R_AC];
+            if (may_be_nonzero(a)) {
+                if (arg < 0 || arg >= count) return -1;
+                next[k] = n;
+                next[k].r[R_AC] = nonzero(a);
+                next_pc[k++] = (int)arg;
+            }
+            if (may_be_zero(a)) {
+                if (pc + 1 >= count) return -1;
+                next[k] = n;
+                next[k].r[R_AC] = exact(0);
+                next_pc[k++] = pc + 1;
+            }
+            return k;
+        }
+        case 14: n.r[R_AC] = top; break; /* child PID + 1, -1, or 0 in the child */
+        case 15: n.r[R_AC] = iv_add(s->r[R_AC], exact(arg)); break;
+        case 17:
+            if (arg < 0 || arg >= size) return -1;
+            n.r[R_AC] = top;
+            break;
+        case 18:
+            if (arg < count || arg >= size) return -1;
+            break;
+        case 19:
+            if (!inside(iv_add(s->r[R_MAR], exact(arg)), 0, size)) return -1;
+            n.r[R_AC] = top;
+            break;
+        case 20:
+            if (!inside(iv_add(s->r[R_MAR], exact(arg)), count, size)) return -1;
+            break;
+        case 21:
+        case 23:
+            n.r[R_SP] = iv_add(s->r[R_SP], exact(-1));
+            if (!inside(n.r[R_SP], count, size)) return -1;
+            if (op == 23) {
+                if (arg < 0 || arg >= count) return -1;
+                next[0] = n;
+                next_pc[0] = (int)arg;
+                return 1;
+            }
+            break;
+        case 22:
+            if (!inside(s->r[R_SP], 0, size)) return -1;
+            n.r[R_AC] = top;
+            n.r[R_SP] = iv_add(s->r[R_SP], exact(1));
+            break;
+        case 24: return -1; /* return address comes from memory */
+        default: break;     /* 13 sleep; the CPU skips invalid opcodes too */
+    }
+    if (pc + 1 >= count) return -1;
+    next[0] = n;
+    next_pc[0] = pc + 1;
+    return 1;
+}
+
+/**
+ * 1 if a process starting at PC 0 with AC = MAR = MBR = 0 and SP = size
+ * can never fetch outside the count words of text, access memory
+ * outside [0, size) or store into the text
+ */
+int verify_program(int (*text)[2], int count, int size)
+{
+    if (!verify_enabled) return 0;
+    programs_checked++;
+    if (!text || count <= 0 || count > size) return 0;
+
+    struct state *st = calloc(count, sizeof(*st));
+    int *work = malloc(count * sizeof(int));
+    char *queued = calloc(count, 1);
+    if (!st || !work || !queued) {
+        free(st);
+        free(work);
+        free(queued);
+        return 0;
+    }
+
+    struct state init;
+    init.reached = 1;
+    init.joins = 0;
+    init.r[R_AC] = init.r[R_MAR] = init.r[R_MBR] = exact(0);
+    init.r[R_SP] = exact(size);
+    join(st, 0, &init);
+
+    /* worklist of PCs whose state changed; each PC is queued at most once */
+    int nwork = 0, proven = 1;
+    work[nwork++] = 0;
+    queued[0] = 1;
+    while (nwork > 0 && proven) {
+        int pc = work[--nwork];
+        queued[pc] = 0;
+        struct state next[2];
+        int next_pc[2];
+        int k = step(text, count, size, pc, &st[pc], next, next_pc);
+        if (k < 0) {
+            proven = 0;
+            break;
+        }
+        for (int i = 0; i < k; ++i) {
+            if (join(st, next_pc[i], &next[i]) && !queued[next_pc[i]]) {
+                queued[next_pc[i]] = 1;
+                work[nwork++] = next_pc[i];
+            }
+        }
+    }
+
+    free(st);
+    free(work);
+    free(queued);
+    if (proven) programs_proven++;
+    return proven;
+}
+
+void print_verify_stats(void)
+{
+    printf("Verifier: %d programs checked, %d proven in bounds (unchecked memory access)\n",
+           programs_checked, programs_proven);
+}
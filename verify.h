@@ -0,0 +1,13 @@
+/**
+ * verify.h
+ * Load-time verifier that proves a program never leaves its partition.
+ */
+#ifndef VERIFY_H
+#define VERIFY_H
+
+extern int verify_enabled;
+
+int verify_program(int (*text)[2], int count, int size);
+void print_verify_stats(void);
+
+#endif